@@ -0,0 +1,116 @@
+#include "../lib5grange/lib5grange.h"
+#include "../lib5grange/grid_map.h"
+#include "../lib5grange/channel_estimator.h"
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+/* Benchmark of the pilot-based channel estimator for every numerology.
+ *
+ * A full band allocation is received over a synthetic multipath channel (a few taps with a Doppler shift
+ * across the subframe) plus white noise at a known SNR. Data REs carry random QPSK, pilot REs the unit
+ * pilot written by map_to_grid(). Reports the estimation time per subframe (and its fraction of the
+ * subframe duration), the MSE of the estimate against the true channel and the estimated SNR / noise
+ * variance against the true ones.
+ *
+ * Usage: channel_estimator_bench [-n iterations] [-s snr dB] [-r number of RBs]
+ */
+
+using namespace lib5grange;
+
+typedef struct{
+    unsigned iterations = 200;
+    float snrDb = 20.0f;
+    unsigned numRB = MAX_NUM_RB;
+}bench_cfg_t;
+
+/** True channel on active subcarrier a and time slot t **/
+static complex<float> channel(size_t numID, size_t a, size_t t){
+    static const float delay[] = {0.0f, 1.5f, 4.0f};        //In samples of the k point FFT
+    static const float gain[] = {0.8f, 0.5f, 0.33f};
+    static const float doppler[] = {0.0f, 0.05f, -0.08f};   //Cycles per subframe
+    const double k = numerology[numID].k;
+    const double slots = get_num_time_slots(numID);
+    complex<double> h(0, 0);
+    for(int p=0;p<3;p++){
+        double phase = -2*M_PI*delay[p]*a/k + 2*M_PI*doppler[p]*t/slots;
+        h += double(gain[p])*complex<double>(cos(phase), sin(phase));
+    }
+    return complex<float>(h);
+}
+
+int main(int argc, char ** argv){
+    bench_cfg_t cfg;
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:r:h"))!=-1){
+        switch(opt){
+            case 'n': cfg.iterations = atoi(optarg); break;
+            case 's': cfg.snrDb = atof(optarg); break;
+            case 'r': cfg.numRB = atoi(optarg); break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-n iterations] [-s snr dB] [-r number of RBs]" << endl;
+                return 1;
+        }
+    }
+    if(cfg.numRB<2 || cfg.numRB>MAX_NUM_RB) cfg.numRB = MAX_NUM_RB;
+    if(cfg.iterations<1) cfg.iterations = 1;
+
+    mt19937 rng(1234);
+    normal_distribution<float> gauss(0.0f, 1.0f);
+    const float qpsk = sqrt(0.5f);
+
+    printf("SNR %.1f dB, %u RBs, %u iterations\n", cfg.snrDb, cfg.numRB, cfg.iterations);
+    printf("num |    REs |  pilots | us/subframe | %% of subframe | ns/RE | MSE (dB) | SNR est (dB) | N0 est/true\n");
+    for(size_t numID=0;numID<6;numID++){
+        allocation_cfg_t allocation;
+        allocation.target_ue_id = 1;
+        allocation.first_rb = 0;
+        allocation.number_of_rb = cfg.numRB;
+        auto map = GridMapCache::instance().get(numID, allocation);
+
+        //Received grid: channel * (pilot or QPSK) + noise
+        const size_t k = numerology[numID].k;
+        const size_t slots = get_num_time_slots(numID);
+        const size_t numSC = cfg.numRB * numerology[numID].subcarriers_per_rb;
+        float power = 0;
+        for(size_t t=0;t<slots;t++)
+            for(size_t a=0;a<numSC;a++) power += norm(channel(numID, a, t));
+        power /= slots*numSC;
+        const float n0 = power * pow(10.0f, -cfg.snrDb/10);
+        const float sigma = sqrt(n0/2);
+        vector<complex<float>> grid(get_grid_size(numID), complex<float>(0, 0));
+        for(size_t t=0;t<slots;t++){
+            for(size_t a=0;a<numSC;a++){
+                complex<float> x = is_pilot_re(numID, a, t) ? complex<float>(1, 0) :
+                    complex<float>(rng()&1 ? qpsk : -qpsk, rng()&1 ? qpsk : -qpsk);
+                grid[t*k + active_to_bin(numID, a)] = channel(numID, a, t)*x + complex<float>(sigma*gauss(rng), sigma*gauss(rng));
+            }
+        }
+
+        ChannelEstimator estimator(numID, allocation);
+        channel_estimate_t est;
+        estimator.estimate(grid.data(), complex<float>(1, 0), est);   //Warm up
+        auto start = chrono::steady_clock::now();
+        for(unsigned i=0;i<cfg.iterations;i++)
+            estimator.estimate(grid.data(), complex<float>(1, 0), est);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now()-start).count() / cfg.iterations;
+
+        double mse = 0;
+        for(size_t t=0;t<slots;t++){
+            for(size_t s=0;s<numSC;s++){
+                complex<float> h = channel(numID, s, t);
+                mse += norm(h - complex<float>(est.h_re[t*numSC+s], est.h_im[t*numSC+s]));
+            }
+        }
+        mse /= slots*numSC;
+
+        printf("%3zu | %6zu | %7zu | %11.2f | %13.3f | %5.2f | %8.2f | %12.2f | %11.3f\n",
+               numID, slots*numSC, map->pilot_idx.size(), seconds*1e6, 100*seconds/get_subframe_duration(numID),
+               seconds*1e9/(slots*numSC), 10*log10(mse/power), est.snr_avg_db, est.noise_var_avg/n0);
+    }
+    return 0;
+}
@@ -0,0 +1,117 @@
+#include "../lib5grange/lib5grange.h"
+#include "../lib5grange/grid_map.h"
+#include <iostream>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+/* Consistency check of build_grid_map() against get_re_capacity() for every numerology.
+ *
+ * For every number of RBs (1 - MAX_NUM_RB), placed at the bottom and at the top of the band (or at every
+ * first RB with -a), the map is built and checked for:
+ *  - data REs == get_re_capacity() (SISO) and layers*data REs == get_re_capacity() (MULTIPLEXING);
+ *  - pilot REs == numRB*numRE/(pilot_df*pilot_dt) and DCI REs == num_dci_qam per DCI;
+ *  - sorted, in-grid indices, no RE in two maps, and data runs covering data_idx;
+ *  - RB runs covering data_idx in order, each symbol tagged with the RB of its subcarrier.
+ * build_grid_map() also asserts the capacity; build with -DNDEBUG to get the full mismatch report.
+ * Prints one line per numerology and returns 1 if any allocation fails.
+ *
+ * Usage: grid_map_check [-a]
+ */
+
+using namespace lib5grange;
+
+/** Checks one allocation, printing the first mismatch found **/
+static bool checkAllocation(size_t numID, const allocation_cfg_t & allocation, size_t & dataRE){
+    grid_map_t map;
+    build_grid_map(numID, allocation, map);
+    const size_t numRB = allocation.number_of_rb;
+    const size_t numRE = numerology[numID].subcarriers_per_rb * get_num_time_slots(numID);
+    const size_t pilots = numRB * (numRE/(numerology[numID].pilot_df*numerology[numID].pilot_dt));
+    const size_t dci = numerology[numID].num_dci_qam * (1 + (numRB-1)/NUM_RB_PER_DCI);
+    const mimo_cfg_t mux = {MULTIPLEXING, 2, 0};
+    dataRE = map.data_idx.size();
+
+    const char * error = NULL;
+    if(map.data_idx.size()!=get_re_capacity(numID, allocation)) error = "data REs != get_re_capacity()";
+    else if(2*map.data_idx.size()!=get_re_capacity(numID, allocation, mux)) error = "data REs != get_re_capacity(MULTIPLEXING)/2";
+    else if(map.pilot_idx.size()!=pilots) error = "pilot REs";
+    else if(map.dci_idx.size()!=dci) error = "DCI REs";
+    else{
+        vector<uint8_t> used(get_grid_size(numID), 0);
+        for(const auto * idx : {&map.data_idx, &map.pilot_idx, &map.dci_idx}){
+            for(size_t i=0;i<idx->size() && !error;i++){
+                uint32_t re = (*idx)[i];
+                if(re>=used.size()) error = "index outside the grid";
+                else if(i>0 && (*idx)[i-1]>=re) error = "indices not sorted";
+                else if(used[re]++) error = "RE mapped twice";
+            }
+        }
+        size_t runREs = 0;
+        for(const auto & run : map.data_runs){
+            for(uint32_t j=0;j<run.length && !error;j++)
+                if(map.data_idx[runREs+j]!=run.offset+j) error = "data runs do not match data_idx";
+            runREs += run.length;
+        }
+        if(!error && runREs!=map.data_idx.size()) error = "data runs do not cover data_idx";
+        const size_t k = numerology[numID].k, kon = numerology[numID].kon;
+        const size_t scPerRb = numerology[numID].subcarriers_per_rb;
+        size_t rbREs = 0;
+        for(const auto & run : map.data_rb_runs){
+            if(run.first!=rbREs || run.first+run.length>map.data_idx.size()){
+                if(!error) error = "RB runs do not follow data_idx";
+                break;
+            }
+            for(uint32_t j=0;j<run.length && !error;j++){
+                size_t a = (map.data_idx[run.first+j] % k + kon/2) % k;
+                if((a - allocation.first_rb*scPerRb)/scPerRb!=run.rb) error = "RB run with the wrong RB";
+            }
+            rbREs += run.length;
+        }
+        if(!error && rbREs!=map.data_idx.size()) error = "RB runs do not cover data_idx";
+    }
+    if(error){
+        printf("numerology %zu, first_rb %u, number_of_rb %u: %s (data %zu, capacity %zu, pilots %zu/%zu, DCI %zu/%zu)\n",
+               numID, unsigned(allocation.first_rb), unsigned(allocation.number_of_rb), error, map.data_idx.size(),
+               get_re_capacity(numID, allocation), map.pilot_idx.size(), pilots, map.dci_idx.size(), dci);
+    }
+    return error==NULL;
+}
+
+int main(int argc, char ** argv){
+    bool all = false;
+    int opt;
+    while((opt = getopt(argc, argv, "ah"))!=-1){
+        switch(opt){
+            case 'a': all = true; break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-a]" << endl;
+                return 1;
+        }
+    }
+
+    bool ok = true;
+    printf("num | allocations | failed | data REs (1 RB) | data REs (%u RBs)\n", unsigned(MAX_NUM_RB));
+    for(size_t numID=0;numID<6;numID++){
+        size_t checked = 0, failed = 0, oneRB = 0, fullBand = 0;
+        for(size_t numRB=1;numRB<=MAX_NUM_RB;numRB++){
+            for(size_t first=0;first+numRB<=MAX_NUM_RB;first++){
+                if(!all && first!=0 && first!=MAX_NUM_RB-numRB) continue;
+                allocation_cfg_t allocation;
+                allocation.target_ue_id = 1;
+                allocation.first_rb = first;
+                allocation.number_of_rb = numRB;
+                size_t dataRE;
+                if(!checkAllocation(numID, allocation, dataRE)) failed++;
+                checked++;
+                if(first==0 && numRB==1) oneRB = dataRE;
+                if(first==0 && numRB==MAX_NUM_RB) fullBand = dataRE;
+            }
+        }
+        printf("%3zu | %11zu | %6zu | %15zu | %zu\n", numID, checked, failed, oneRB, fullBand);
+        ok = ok && failed==0;
+    }
+    printf(ok ? "All maps match get_re_capacity()\n" : "Mismatches found\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+#include "../lib5grange/lib5grange.h"
+#include "../lib5grange/harq_buffer.h"
+#include <iostream>
+#include <vector>
+#include <map>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+/* Consistency check of HarqBufferPool.
+ *
+ * 1. Combining: a transmission and two retransmissions of one process must leave the saturated sum of the
+ *    LLRs in the buffer and in the combined output; ack() must give the blocks back to the pool.
+ * 2. Eviction: with the blocks or the process entries exhausted, a new process must evict the least recently
+ *    used one (not fail), keeping the processes touched since.
+ * 3. Random traffic (new data, retransmissions, size changes, acks) over many UEs against a plain reference
+ *    model of the pool (std::map, LRU by linear scan), including transmissions larger than the pool: every
+ *    status, buffer, transmission count and usage counter must match.
+ * Returns 1 on any mismatch.
+ *
+ * Usage: harq_buffer_check [-n operations]
+ */
+
+using namespace lib5grange;
+
+/** Reference model: what the pool should hold after every call **/
+typedef struct{
+    vector<int8_t> llr;
+    uint64_t lastUse;
+    unsigned transmissions;
+}model_process_t;
+
+typedef struct{
+    size_t blockLlrs;
+    size_t numBlocks;
+    size_t maxProcesses;
+    map<uint32_t, model_process_t> processes;
+    uint64_t clock = 0;
+    uint64_t evictions = 0;
+
+    size_t blocks(const model_process_t & p) const {return (p.llr.size() + blockLlrs - 1)/blockLlrs;}
+    size_t usedBlocks() const {
+        size_t used = 0;
+        for(const auto & p : processes) used += blocks(p.second);
+        return used;
+    }
+    /** Least recently used process (with blocks if withBlocks), except keep **/
+    map<uint32_t, model_process_t>::iterator oldest(uint32_t keep, bool withBlocks){
+        auto best = processes.end();
+        for(auto it=processes.begin();it!=processes.end();++it){
+            if(it->first==keep || (withBlocks && blocks(it->second)==0)) continue;
+            if(best==processes.end() || it->second.lastUse<best->second.lastUse) best = it;
+        }
+        return best;
+    }
+    harq_status_t combine(uint32_t key, const vector<int8_t> & llr, bool newData){
+        auto it = processes.find(key);
+        if(it==processes.end()){
+            if(processes.size()==maxProcesses){
+                auto victim = oldest(key, false);
+                if(victim==processes.end()) return HARQ_NO_MEMORY;
+                processes.erase(victim);
+                evictions++;
+            }
+            it = processes.insert({key, {{}, 0, 0}}).first;
+            newData = true;
+        }
+        it->second.lastUse = ++clock;
+        if(it->second.llr.size()!=llr.size()) newData = true;
+        if(newData){
+            size_t needed = (llr.size() + blockLlrs - 1)/blockLlrs;
+            if(needed!=blocks(it->second)){
+                it->second.llr.clear();
+                while(numBlocks - usedBlocks() < needed){
+                    auto victim = oldest(key, true);
+                    if(victim==processes.end()){
+                        processes.erase(it);
+                        return HARQ_NO_MEMORY;
+                    }
+                    processes.erase(victim);
+                    evictions++;
+                }
+            }
+            it->second.llr = llr;
+            it->second.transmissions = 1;
+            return HARQ_NEW_DATA;
+        }
+        for(size_t i=0;i<llr.size();i++){
+            int v = it->second.llr[i] + llr[i];
+            it->second.llr[i] = v>HARQ_LLR_MAX ? HARQ_LLR_MAX : (v<-HARQ_LLR_MAX ? -HARQ_LLR_MAX : v);
+        }
+        if(it->second.transmissions<255) it->second.transmissions++;
+        return HARQ_COMBINED;
+    }
+}model_pool_t;
+
+static vector<int8_t> randomLlrs(mt19937 & rng, size_t n){
+    vector<int8_t> llr(n);
+    for(auto & v : llr) v = int8_t(int(rng()%255) - 127);
+    return llr;
+}
+
+int main(int argc, char ** argv){
+    unsigned operations = 200000;
+    int opt;
+    while((opt = getopt(argc, argv, "n:h"))!=-1){
+        switch(opt){
+            case 'n': operations = atoi(optarg); break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-n operations]" << endl;
+                return 1;
+        }
+    }
+    mt19937 rng(1234);
+    size_t failures = 0;
+
+    //1. Combining and ack
+    {
+        const size_t n = 10000;
+        HarqBufferPool pool(16*1024, 16, 1024);
+        vector<int8_t> sum(n, 0), combined(n), stored(n);
+        bool ok = true;
+        for(int t=0;t<3;t++){
+            vector<int8_t> llr = randomLlrs(rng, n);
+            for(size_t i=0;i<n;i++){
+                int v = (t==0 ? 0 : sum[i]) + llr[i];
+                sum[i] = v>HARQ_LLR_MAX ? HARQ_LLR_MAX : (v<-HARQ_LLR_MAX ? -HARQ_LLR_MAX : v);
+            }
+            harq_status_t status = pool.combine(7, 3, llr.data(), n, t==0, combined.data());
+            ok = ok && status==(t==0 ? HARQ_NEW_DATA : HARQ_COMBINED) && combined==sum;
+        }
+        ok = ok && pool.read(7, 3, stored.data())==n && stored==sum && pool.transmissions(7, 3)==3;
+        ok = ok && pool.stats().blocks_used==10 && pool.stats().combines==2;
+        pool.ack(7, 3);
+        ok = ok && pool.read(7, 3, stored.data())==0 && pool.stats().blocks_used==0 && pool.stats().processes==0;
+        printf("Combine and ack: %s\n", ok ? "ok" : "FAILED");
+        failures += !ok;
+    }
+
+    //2. Eviction (blocks, then process entries)
+    {
+        bool ok = true;
+        vector<int8_t> llr = randomLlrs(rng, 2048);
+        HarqBufferPool blocks(8*1024, 64, 1024);                //Room for 4 processes of 2 blocks
+        for(uint8_t p=0;p<4;p++) ok = ok && blocks.combine(1, p, llr.data(), llr.size(), true)==HARQ_NEW_DATA;
+        ok = ok && blocks.combine(1, 0, llr.data(), llr.size(), false)==HARQ_COMBINED;     //Process 1 is now the LRU
+        ok = ok && blocks.combine(2, 0, llr.data(), llr.size(), true)==HARQ_NEW_DATA;
+        ok = ok && blocks.transmissions(1, 1)==0 && blocks.transmissions(1, 0)==2 && blocks.transmissions(1, 2)==1;
+        ok = ok && blocks.stats().evictions==1 && blocks.stats().failures==0;
+
+        HarqBufferPool entries(64*1024, 4, 1024);               //Room for 4 processes whatever the blocks
+        for(uint8_t p=0;p<4;p++) ok = ok && entries.combine(1, p, llr.data(), 100, true)==HARQ_NEW_DATA;
+        ok = ok && entries.combine(1, 0, llr.data(), 100, false)==HARQ_COMBINED;           //Process 1 is now the LRU
+        ok = ok && entries.combine(3, 9, llr.data(), 100, true)==HARQ_NEW_DATA;
+        ok = ok && entries.transmissions(1, 1)==0 && entries.transmissions(1, 0)==2 && entries.transmissions(3, 9)==1;
+        ok = ok && entries.stats().evictions==1 && entries.stats().failures==0 && entries.stats().processes==4;
+        printf("Eviction: %s\n", ok ? "ok" : "FAILED");
+        failures += !ok;
+    }
+
+    //3. Random traffic against the reference model
+    {
+        const size_t blockLlrs = 256, numBlocks = 200, maxProcesses = 48;
+        HarqBufferPool pool(numBlocks*blockLlrs, maxProcesses, blockLlrs);
+        model_pool_t model;
+        model.blockLlrs = blockLlrs;
+        model.numBlocks = numBlocks;
+        model.maxProcesses = maxProcesses;
+        const size_t sizes[] = {100, 256, 700, 2000, 5000, 60000};   //The last one does not fit in the pool
+        vector<int8_t> out(60000);
+        size_t mismatches = 0;
+        for(unsigned op=0;op<operations && mismatches==0;op++){
+            uint16_t ue = rng()%24;
+            uint8_t process = rng()%8;
+            uint32_t key = (uint32_t(ue) << 8) | process;
+            unsigned action = rng()%10;
+            if(action==0){
+                pool.ack(ue, process);
+                model.processes.erase(key);
+            }
+            else{
+                auto it = model.processes.find(key);
+                size_t n = (it!=model.processes.end() && action<8) ? it->second.llr.size() : sizes[rng()%6];
+                vector<int8_t> llr = randomLlrs(rng, n);
+                bool newData = action>=6;
+                harq_status_t status = pool.combine(ue, process, llr.data(), n, newData, out.data());
+                if(status!=model.combine(key, llr, newData)) mismatches++;
+            }
+            //Check the touched process and the counters
+            auto it = model.processes.find(key);
+            size_t n = pool.read(ue, process, out.data());
+            if(it==model.processes.end() ? n!=0 : (n!=it->second.llr.size() || !equal(it->second.llr.begin(), it->second.llr.end(), out.begin()) ||
+                                                     pool.transmissions(ue, process)!=it->second.transmissions)) mismatches++;
+            const harq_stats_t & stats = pool.stats();
+            if(stats.processes!=model.processes.size() || stats.blocks_used!=model.usedBlocks() || stats.evictions!=model.evictions) mismatches++;
+        }
+        //Every process still held
+        for(const auto & p : model.processes){
+            size_t n = pool.read(p.first >> 8, p.first & 0xFF, out.data());
+            if(n!=p.second.llr.size() || !equal(p.second.llr.begin(), p.second.llr.end(), out.begin())) mismatches++;
+        }
+        const harq_stats_t & stats = pool.stats();
+        printf("Random traffic: %u operations, %llu combines, %llu evictions, %llu failures, peak %zu/%zu blocks, %zu mismatches %s\n",
+               operations, (unsigned long long) stats.combines, (unsigned long long) stats.evictions,
+               (unsigned long long) stats.failures, stats.blocks_peak, stats.blocks_total, mismatches, mismatches ? "FAILED" : "");
+        failures += mismatches>0;
+    }
+    printf(failures ? "Mismatches found\n" : "All checks passed\n");
+    return failures ? 1 : 0;
+}
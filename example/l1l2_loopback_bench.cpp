@@ -0,0 +1,307 @@
+#include "../libMac5gRange/libMac5gRange.h"
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <memory>
+#include <time.h>
+#include <signal.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/* MAC <-> PHY loopback benchmark of l1_l2_interface_t.
+ *
+ * The producer (MAC side) sends, per subframe, a serialized BSSubframeTx_Start on mqControlToPhy and a
+ * serialized MacPDU on mqPduToPhy. The consumer (PHY side, a forked process) deserializes both, then answers
+ * with a serialized RxMetrics (per RB SNR, average SNR, rank indicator...) on mqControlFromPhy and the MacPDU
+ * re-serialized on mqPduFromPhy, which the producer deserializes. Every message carries its send time
+ * (CLOCK_MONOTONIC) as a trailer, so the one-way latency (send -> deserialized) of control messages and PDUs
+ * is measured on both directions, plus the round trip. Receives wait at most RECEIVE_POLL_NS at a time and
+ * give up when the other process has exited, so neither side hangs if the other one stops early.
+ *
+ * Usage: l1l2_loopback_bench [-n messages] [-s pdu bytes] [-w window] [-p producer cpu] [-c consumer cpu] [-u numUEs]
+ */
+
+#define RECEIVE_POLL_NS 100000000ULL     //Receive wait before checking that the other process is alive
+
+typedef struct{
+    unsigned numMessages = 100000;  //Subframes sent (each one is 2 messages per direction)
+    unsigned pduBytes = 1024;       //MacPDU::mac_data_ size
+    unsigned window = 32;           //Subframes in flight (below MQ_MAX_NUM_MSG)
+    int producerCpu = -1;           //-1: not pinned
+    int consumerCpu = -1;
+    unsigned numUEs = 4;            //ulReservations in BSSubframeTx_Start
+}bench_cfg_t;
+
+typedef struct{
+    double userSeconds;
+    double systemSeconds;
+    uint64_t bytes;                 //Bytes received (all queues)
+}process_usage_t;
+
+static uint64_t nowNs(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+}
+
+static void pinToCpu(int cpu, const char * who){
+    if(cpu<0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(sched_setaffinity(0, sizeof(set), &set)==-1)
+        perror(who);
+}
+
+static process_usage_t usage(uint64_t bytes){
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    process_usage_t u;
+    u.userSeconds = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec*1e-6;
+    u.systemSeconds = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec*1e-6;
+    u.bytes = bytes;
+    return u;
+}
+
+/** Sends bytes plus the send time trailer **/
+static bool sendStamped(l1_l2_interface_t & l1l2, L1L2Queues queue, vector<uint8_t> & bytes){
+    push_bytes(bytes, nowNs());
+    if(!l1l2.send(queue, bytes)){
+        perror("mq_send");
+        return false;
+    }
+    return true;
+}
+
+/** True while the other process runs (peer: the child, or the parent seen from the child) **/
+static bool peerAlive(pid_t peer){
+    if(peer==getppid()) return true;                //Our parent (a dead parent reparents us)
+    return waitpid(peer, NULL, WNOHANG)==0;         //Our child, not exited yet
+}
+
+/**
+ * Receives a message (as l1_l2_interface_t::receive(), no per message buffer allocation) and pops its send
+ * time trailer. Waits in RECEIVE_POLL_NS steps, failing if the peer process has exited.
+ */
+static bool receiveStamped(l1_l2_interface_t & l1l2, L1L2Queues queue, vector<uint8_t> & bytes, uint64_t & sentNs, pid_t peer){
+    static unique_ptr<char[]> buffer(new char[MQ_MAX_MSG_SIZE]);
+    ssize_t size;
+    for(;;){
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t ns = deadline.tv_nsec + RECEIVE_POLL_NS;
+        deadline.tv_sec += ns/1000000000ULL;
+        deadline.tv_nsec = ns%1000000000ULL;
+        size = mq_timedreceive(l1l2.descriptor(queue), buffer.get(), MQ_MAX_MSG_SIZE, NULL, &deadline);
+        if(size!=-1) break;
+        if(errno==ETIMEDOUT && peerAlive(peer)) continue;
+        if(errno==EINTR) continue;
+        if(errno==ETIMEDOUT) cerr << "Other process exited" << endl;
+        else perror("mq_timedreceive");
+        return false;
+    }
+    bytes.assign(buffer.get(), buffer.get()+size);
+    pop_bytes(sentNs, bytes);
+    return true;
+}
+
+static void printPercentiles(const char * name, uint64_t * samples, size_t count){
+    if(count==0) return;
+    sort(samples, samples+count);
+    double sum = 0;
+    for(size_t i=0;i<count;i++) sum += samples[i];
+    auto pct = [&](double p){ return samples[min(count-1, (size_t) (p*count))]/1000.0; };
+    printf("%-24s avg %8.2f us | p50 %8.2f | p90 %8.2f | p99 %8.2f | p99.9 %8.2f | max %8.2f\n",
+           name, sum/count/1000.0, pct(0.5), pct(0.9), pct(0.99), pct(0.999), samples[count-1]/1000.0);
+}
+
+/** Latencies measured by the consumer process (shared memory) **/
+typedef struct{
+    uint64_t * controlDown;         //BSSubframeTx_Start, MAC->PHY
+    uint64_t * pduDown;             //MacPDU, MAC->PHY
+}consumer_latency_t;
+
+/** PHY side: receives control + PDU, answers with RxMetrics + the PDU **/
+static void consumer(l1_l2_interface_t & l1l2, const bench_cfg_t & cfg, consumer_latency_t latency, process_usage_t * result){
+    const pid_t parent = getppid();
+    pinToCpu(cfg.consumerCpu, "Error pinning consumer");
+    vector<uint8_t> bytes, reply;
+    bytes.reserve(MQ_MAX_MSG_SIZE);
+    reply.reserve(MQ_MAX_MSG_SIZE);
+    uint64_t received = 0;
+    BSSubframeTx_Start subframeStart;
+    RxMetrics metrics;
+    metrics.snr.assign(132, 20.0f);
+    metrics.snr_avg = 20.0f;
+    metrics.rankIndicator = 1;
+    metrics.ssReport = 0;
+
+    for(unsigned i=0;i<cfg.numMessages;i++){
+        uint64_t sentControl, sentPdu;
+        if(!receiveStamped(l1l2, CONTROL_TO_PHY, bytes, sentControl, parent)) break;
+        received += bytes.size()+8;
+        subframeStart.deserialize(bytes);
+        latency.controlDown[i] = nowNs()-sentControl;
+
+        if(!receiveStamped(l1l2, PDU_TO_PHY, bytes, sentPdu, parent)) break;
+        received += bytes.size()+8;
+        MacPDU pdu(bytes);
+        latency.pduDown[i] = nowNs()-sentPdu;
+
+        //Whole RxMetrics: per RB SNR and SS report, then average SNR, rank indicator and RBs
+        reply.clear();
+        metrics.numberRBs = pdu.allocation_.number_of_rb;
+        metrics.snr_ssr_serialize(reply);
+        metrics.snr_avg_ri_serialize(reply);
+        if(!sendStamped(l1l2, CONTROL_FROM_PHY, reply)) break;
+        reply.clear();
+        pdu.serialize(reply);
+        if(!sendStamped(l1l2, PDU_FROM_PHY, reply)) break;
+    }
+    *result = usage(received);
+}
+
+int main(int argc, char ** argv){
+    bench_cfg_t cfg;
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:w:p:c:u:h"))!=-1){
+        switch(opt){
+            case 'n': cfg.numMessages = atoi(optarg); break;
+            case 's': cfg.pduBytes = atoi(optarg); break;
+            case 'w': cfg.window = atoi(optarg); break;
+            case 'p': cfg.producerCpu = atoi(optarg); break;
+            case 'c': cfg.consumerCpu = atoi(optarg); break;
+            case 'u': cfg.numUEs = atoi(optarg); break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-n messages] [-s pdu bytes] [-w window] [-p producer cpu] [-c consumer cpu] [-u numUEs]" << endl;
+                return 1;
+        }
+    }
+    if(cfg.window<1 || cfg.window>=MQ_MAX_NUM_MSG) cfg.window = MQ_MAX_NUM_MSG-1;
+    if(cfg.pduBytes+256>MQ_MAX_MSG_SIZE){
+        cerr << "PDU size must be below " << MQ_MAX_MSG_SIZE-256 << " bytes" << endl;
+        return 1;
+    }
+
+    //Shared results of the consumer process
+    size_t sharedSize = sizeof(process_usage_t) + 2*cfg.numMessages*sizeof(uint64_t);
+    uint8_t * shared = (uint8_t *) mmap(NULL, sharedSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if(shared==MAP_FAILED){
+        perror("Error mapping shared results");
+        return 1;
+    }
+    process_usage_t * consumerUsage = (process_usage_t *) shared;
+    consumer_latency_t latencyDown;
+    latencyDown.controlDown = (uint64_t *) (shared + sizeof(process_usage_t));
+    latencyDown.pduDown = latencyDown.controlDown + cfg.numMessages;
+
+    l1_l2_interface_t l1l2;
+    l1l2.createMessageQueues();
+    if(l1l2.mqPduToPhy==-1 || l1l2.mqPduFromPhy==-1 || l1l2.mqControlToPhy==-1 || l1l2.mqControlFromPhy==-1){
+        cerr << "Message queues not available (check RLIMIT_MSGQUEUE and /proc/sys/fs/mqueue)" << endl;
+        l1l2.closeMessageQueues();
+        return 1;
+    }
+
+    pid_t child = fork();
+    if(child==-1){
+        perror("fork");
+        return 1;
+    }
+    if(child==0){
+        consumer(l1l2, cfg, latencyDown, consumerUsage);
+        _exit(0);
+    }
+
+    //MAC side
+    pinToCpu(cfg.producerCpu, "Error pinning producer");
+    MacPDU pdu;
+    pdu.numID_ = 2;
+    pdu.allocation_.target_ue_id = 1;
+    pdu.allocation_.number_of_rb = 132;
+    pdu.mcs_.modulation = QAM64;
+    pdu.mac_data_.assign(cfg.pduBytes, 0xA5);
+
+    BSSubframeTx_Start subframeStart;
+    subframeStart.numUEs = cfg.numUEs;
+    subframeStart.numPDUs = 1;
+    subframeStart.ulReservations.resize(cfg.numUEs);
+    subframeStart.numerology = 2;
+    subframeStart.ofdm_gfdm = 0;
+    subframeStart.fLutDL = 0;
+    subframeStart.rxMetricPeriodicity = 2;
+
+    vector<uint64_t> controlUp(cfg.numMessages), latencyUp(cfg.numMessages), roundTrip(cfg.numMessages), sendTime(cfg.numMessages);
+    vector<uint8_t> bytes;
+    bytes.reserve(MQ_MAX_MSG_SIZE);
+    RxMetrics metrics;
+    uint64_t received = 0;
+    unsigned sent = 0, done = 0;
+    bool ok = true;
+
+    uint64_t start = nowNs();
+    while(ok && done<cfg.numMessages){
+        //Fill the window
+        while(sent<cfg.numMessages && sent-done<cfg.window){
+            sendTime[sent] = nowNs();
+            bytes.clear();
+            subframeStart.serialize(bytes);
+            ok = sendStamped(l1l2, CONTROL_TO_PHY, bytes);
+            pdu.macphy_ctl_.subframe_number = sent;
+            bytes.clear();
+            pdu.serialize(bytes);
+            ok = ok && sendStamped(l1l2, PDU_TO_PHY, bytes);
+            if(!ok) break;
+            sent++;
+        }
+        //Collect one answer
+        uint64_t sentMetrics, sentPdu;
+        if(!ok || !receiveStamped(l1l2, CONTROL_FROM_PHY, bytes, sentMetrics, child)) break;
+        received += bytes.size()+8;
+        metrics.snr_avg_ri_deserialize(bytes);
+        metrics.snr_ssr_deserialize(bytes);
+        controlUp[done] = nowNs()-sentMetrics;
+        if(metrics.snr.size()!=132){
+            cerr << "RxMetrics with " << metrics.snr.size() << " SNR values" << endl;
+            break;
+        }
+        if(!receiveStamped(l1l2, PDU_FROM_PHY, bytes, sentPdu, child)) break;
+        received += bytes.size()+8;
+        MacPDU answer(bytes);
+        uint64_t now = nowNs();
+        latencyUp[done] = now-sentPdu;
+        roundTrip[done] = now-sendTime[answer.macphy_ctl_.subframe_number];
+        done++;
+    }
+    uint64_t elapsed = nowNs()-start;
+    if(done<cfg.numMessages) kill(child, SIGTERM);     //The consumer may be waiting for messages never sent
+    waitpid(child, NULL, 0);
+    process_usage_t producerUsage = usage(received);
+    l1l2.closeMessageQueues();
+
+    double seconds = elapsed/1e9;
+    uint64_t bytesDown = consumerUsage->bytes, bytesUp = producerUsage.bytes;
+    printf("Subframes: %u (PDU %u bytes, %u UEs, window %u, cpus %d/%d)\n", done, cfg.pduBytes, cfg.numUEs,
+           cfg.window, cfg.producerCpu, cfg.consumerCpu);
+    printf("Throughput: %.0f PDUs/s each way, %.3f GB/s down, %.3f GB/s up, %.0f messages/s total\n",
+           done/seconds, bytesDown/seconds/1e9, bytesUp/seconds/1e9, 4.0*done/seconds);
+    printPercentiles("Control MAC->PHY:", latencyDown.controlDown, done);
+    printPercentiles("Control PHY->MAC:", controlUp.data(), done);
+    printPercentiles("PDU MAC->PHY:", latencyDown.pduDown, done);
+    printPercentiles("PDU PHY->MAC:", latencyUp.data(), done);
+    printPercentiles("Round trip:", roundTrip.data(), done);
+    double messages = 2.0*done;     //Messages sent by each process
+    printf("CPU per message: producer %.2f us (user %.2f, sys %.2f), consumer %.2f us (user %.2f, sys %.2f)\n",
+           (producerUsage.userSeconds+producerUsage.systemSeconds)/messages*1e6,
+           producerUsage.userSeconds/messages*1e6, producerUsage.systemSeconds/messages*1e6,
+           (consumerUsage->userSeconds+consumerUsage->systemSeconds)/messages*1e6,
+           consumerUsage->userSeconds/messages*1e6, consumerUsage->systemSeconds/messages*1e6);
+    munmap(shared, sharedSize);
+    return done==cfg.numMessages ? 0 : 1;
+}
@@ -0,0 +1,224 @@
+#include "../lib5grange/lib5grange.h"
+#include "../lib5grange/grid_map.h"
+#include "../lib5grange/mimo_detector.h"
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+/* Consistency check of the 2x2 MIMO detectors.
+ *
+ * 1. mmse_2x2_detect() (AVX2 kernel plus scalar tail when built with -mavx2) against mmse_2x2_scalar() on
+ *    random channels, and a noiseless round trip y = H s (the unbiased filter must return s).
+ * 2. alamouti_combine() on a whole batch against the same call made pair by pair (which takes the scalar
+ *    path), for 1 and 2 receive antennas, and a noiseless round trip of Alamouti coded pairs.
+ * 3. mmse_2x2_detect_rb() and sinr_to_noise_var() on the data of a grid-mapped allocation of every
+ *    numerology (data_idx order, one channel per RB): every symbol must be recovered with the channel of
+ *    its own RB, and the per RB noise variances must come from the REs of that RB.
+ * Returns 1 on any mismatch.
+ *
+ * Usage: mimo_detector_check [-t tolerance]
+ */
+
+using namespace lib5grange;
+
+/** SoA buffers of a 2x2 channel and two streams **/
+typedef struct{
+    vector<float> h[2][2][2];   //[r][t][re/im]
+    vector<float> y[2][2];      //[antenna][re/im]
+    vector<float> x[2][2];      //[stream][re/im]
+    vector<float> sinr[2];
+
+    void resize(size_t n){
+        for(auto & r : h) for(auto & t : r) for(auto & v : t) v.assign(n, 0);
+        for(auto & a : y) for(auto & v : a) v.assign(n, 0);
+        for(auto & a : x) for(auto & v : a) v.assign(n, 0);
+        for(auto & v : sinr) v.assign(n, 0);
+    }
+    mimo_channel_t channel(size_t offset = 0) const{
+        mimo_channel_t c;
+        for(int r=0;r<2;r++) for(int t=0;t<2;t++){
+            c.re[r][t] = h[r][t][0].data() + offset;
+            c.im[r][t] = h[r][t][1].data() + offset;
+        }
+        return c;
+    }
+    mimo_streams_t input(size_t offset = 0){
+        return {{y[0][0].data()+offset, y[1][0].data()+offset}, {y[0][1].data()+offset, y[1][1].data()+offset}};
+    }
+    mimo_streams_t output(size_t offset = 0){
+        return {{x[0][0].data()+offset, x[1][0].data()+offset}, {x[0][1].data()+offset, x[1][1].data()+offset}};
+    }
+}mimo_buffers_t;
+
+static float relErr(float a, float b){
+    return fabsf(a-b)/max(1.0f, fabsf(b));
+}
+
+int main(int argc, char ** argv){
+    float tolerance = 1e-3f;
+    int opt;
+    while((opt = getopt(argc, argv, "t:h"))!=-1){
+        switch(opt){
+            case 't': tolerance = atof(optarg); break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-t tolerance]" << endl;
+                return 1;
+        }
+    }
+#if defined(__AVX2__)
+    printf("Kernels: AVX2 + scalar\n");
+#else
+    printf("Kernels: scalar only (build with -mavx2 to check the SIMD paths)\n");
+#endif
+
+    mt19937 rng(1234);
+    normal_distribution<float> gauss(0.0f, sqrtf(0.5f));
+    const float qpsk = sqrtf(0.5f);
+    auto symbol = [&](){return complex<float>(rng()&1 ? qpsk : -qpsk, rng()&1 ? qpsk : -qpsk);};
+    size_t failures = 0;
+
+    //1. MMSE per RE
+    {
+        const size_t n = 1003;
+        mimo_buffers_t b, ref;
+        b.resize(n);
+        vector<complex<float>> s[2];
+        for(auto & v : s) v.resize(n);
+        for(size_t i=0;i<n;i++){
+            complex<float> hc[2][2];
+            for(int r=0;r<2;r++) for(int t=0;t<2;t++){
+                hc[r][t] = complex<float>(gauss(rng), gauss(rng));
+                b.h[r][t][0][i] = hc[r][t].real();
+                b.h[r][t][1][i] = hc[r][t].imag();
+            }
+            s[0][i] = symbol();
+            s[1][i] = symbol();
+            for(int r=0;r<2;r++){
+                complex<float> yr = hc[r][0]*s[0][i] + hc[r][1]*s[1][i];
+                b.y[r][0][i] = yr.real();
+                b.y[r][1][i] = yr.imag();
+            }
+        }
+        ref = b;
+        float * const sinr[2] = {b.sinr[0].data(), b.sinr[1].data()};
+        float * const sinrRef[2] = {ref.sinr[0].data(), ref.sinr[1].data()};
+        mmse_2x2_detect(b.channel(), b.input(), n, 1e-6f, b.output(), sinr);
+        mmse_2x2_scalar(ref.channel(), ref.input(), 0, n, 1e-6f, ref.output(), sinrRef);
+        float maxErr = 0, roundTrip = 0;
+        for(size_t i=0;i<n;i++){
+            for(int st=0;st<2;st++){
+                maxErr = max(maxErr, relErr(b.x[st][0][i], ref.x[st][0][i]));
+                maxErr = max(maxErr, relErr(b.x[st][1][i], ref.x[st][1][i]));
+                maxErr = max(maxErr, relErr(b.sinr[st][i], ref.sinr[st][i]));
+                //Badly conditioned channels amplify rounding; skip the worst ones for the round trip
+                if(ref.sinr[st][i] > 1e3f) roundTrip = max(roundTrip, abs(complex<float>(b.x[st][0][i], b.x[st][1][i]) - s[st][i]));
+            }
+        }
+        bool ok = maxErr<=tolerance && roundTrip<=1e-2f;
+        printf("MMSE per RE:  max relative error vs scalar %.2e, noiseless round trip error %.2e %s\n", maxErr, roundTrip, ok ? "" : "FAILED");
+        failures += !ok;
+    }
+
+    //2. Alamouti
+    for(size_t numRx=1;numRx<=2;numRx++){
+        const size_t n = 2*517;
+        mimo_buffers_t b;
+        b.resize(n);
+        vector<complex<float>> s(n);
+        for(size_t i=0;i<n;i+=2){
+            s[i] = symbol();
+            s[i+1] = symbol();
+            for(size_t r=0;r<numRx;r++){
+                complex<float> h1(gauss(rng), gauss(rng)), h2(gauss(rng), gauss(rng));
+                for(size_t j=0;j<2;j++){
+                    b.h[r][0][0][i+j] = h1.real(); b.h[r][0][1][i+j] = h1.imag();
+                    b.h[r][1][0][i+j] = h2.real(); b.h[r][1][1][i+j] = h2.imag();
+                }
+                complex<float> ya = h1*s[i] + h2*s[i+1];
+                complex<float> yb = -h1*conj(s[i+1]) + h2*conj(s[i]);
+                b.y[r][0][i] = ya.real(); b.y[r][1][i] = ya.imag();
+                b.y[r][0][i+1] = yb.real(); b.y[r][1][i+1] = yb.imag();
+            }
+        }
+        vector<float> xr(n), xi(n), sinr(n), pr(n), pi(n), psinr(n);
+        alamouti_combine(b.channel(), numRx, b.input(), n, 1e-3f, xr.data(), xi.data(), sinr.data());
+        for(size_t i=0;i<n;i+=2)
+            alamouti_combine(b.channel(i), numRx, b.input(i), 2, 1e-3f, pr.data()+i, pi.data()+i, psinr.data()+i);
+        float maxErr = 0, roundTrip = 0;
+        for(size_t i=0;i<n;i++){
+            maxErr = max(maxErr, max(relErr(xr[i], pr[i]), max(relErr(xi[i], pi[i]), relErr(sinr[i], psinr[i]))));
+            roundTrip = max(roundTrip, abs(complex<float>(xr[i], xi[i]) - s[i]));
+        }
+        bool ok = maxErr<=tolerance && roundTrip<=1e-4f;
+        printf("Alamouti %zu RX: max relative error vs scalar %.2e, noiseless round trip error %.2e %s\n", numRx, maxErr, roundTrip, ok ? "" : "FAILED");
+        failures += !ok;
+    }
+
+    //3. Per RB detection on grid-mapped data
+    for(size_t numID=0;numID<6;numID++){
+        allocation_cfg_t allocation;
+        allocation.target_ue_id = 1;
+        allocation.first_rb = 5;
+        allocation.number_of_rb = 40;
+        auto map = GridMapCache::instance().get(numID, allocation);
+        const size_t n = map->data_idx.size();
+        const size_t numRB = allocation.number_of_rb;
+        const size_t k = numerology[numID].k, kon = numerology[numID].kon;
+        const size_t scPerRb = numerology[numID].subcarriers_per_rb;
+
+        //Well conditioned channel per RB: identity plus a small random coupling
+        mimo_buffers_t rb;
+        rb.resize(numRB);
+        vector<float> noiseVar(numRB);
+        for(size_t r=0;r<numRB;r++){
+            for(int a=0;a<2;a++) for(int t=0;t<2;t++){
+                complex<float> c = (a==t ? complex<float>(1, 0) : complex<float>(0, 0)) + 0.3f*complex<float>(gauss(rng), gauss(rng));
+                rb.h[a][t][0][r] = c.real();
+                rb.h[a][t][1][r] = c.imag();
+            }
+            noiseVar[r] = 1e-6f*(1 + r);
+        }
+        mimo_buffers_t re;
+        re.resize(n);
+        vector<complex<float>> s[2];
+        for(auto & v : s) v.resize(n);
+        for(size_t i=0;i<n;i++){
+            size_t r = ((map->data_idx[i] % k + kon/2) % k - allocation.first_rb*scPerRb)/scPerRb;
+            s[0][i] = symbol();
+            s[1][i] = symbol();
+            for(int a=0;a<2;a++){
+                complex<float> h0(rb.h[a][0][0][r], rb.h[a][0][1][r]), h1(rb.h[a][1][0][r], rb.h[a][1][1][r]);
+                complex<float> y = h0*s[0][i] + h1*s[1][i];
+                re.y[a][0][i] = y.real();
+                re.y[a][1][i] = y.imag();
+            }
+        }
+        float * const sinrRb[2] = {rb.sinr[0].data(), rb.sinr[1].data()};
+        mmse_2x2_detect_rb(rb.channel(), numRB, re.input(), map->data_rb_runs, noiseVar.data(), re.output(), sinrRb);
+        float roundTrip = 0;
+        for(size_t i=0;i<n;i++)
+            for(int st=0;st<2;st++)
+                roundTrip = max(roundTrip, abs(complex<float>(re.x[st][0][i], re.x[st][1][i]) - s[st][i]));
+
+        //Per RE SINR equal to (RB index + 1): the per RB noise variance must be 1/(RB index + 1)
+        vector<float> sinrRe(n), nvRe, nvRb;
+        for(const auto & run : map->data_rb_runs)
+            for(size_t j=0;j<run.length;j++) sinrRe[run.first+j] = float(run.rb + 1);
+        sinr_to_noise_var(sinrRe.data(), map->data_rb_runs, numRB, nvRe);
+        sinr_to_noise_var(rb.sinr[0].data(), numRB, nvRb);
+        float nvErr = 0;
+        for(size_t r=0;r<numRB;r++){
+            nvErr = max(nvErr, relErr(nvRe[r], 1.0f/(r+1)));
+            nvErr = max(nvErr, relErr(nvRb[r], 1.0f/rb.sinr[0][r]));
+        }
+        bool ok = roundTrip<=1e-3f && nvErr<=1e-6f;
+        printf("Numerology %zu: %zu REs in %zu RB runs, round trip error %.2e, noise variance error %.2e %s\n",
+               numID, n, map->data_rb_runs.size(), roundTrip, nvErr, ok ? "" : "FAILED");
+        failures += !ok;
+    }
+    printf(failures ? "Mismatches found\n" : "All checks passed\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,104 @@
+#include "../lib5grange/lib5grange.h"
+#include "../lib5grange/sdu_packer.h"
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+/* Benchmark of SDU packing and unpacking.
+ *
+ * Packs a stream of random packets of a fixed size into PDUs of the net capacity of a full band, QAM256
+ * allocation of numerology 0 at the given code rate (so large packets are segmented across PDUs), then
+ * unpacks and reassembles them, checking every delivered packet against the original. mac_data_ buffers
+ * are allocated before timing (reused, or one per PDU kept for the unpack pass). Reports the SDU bytes per
+ * second of pack() (packets queued as spans and as adopted vectors) and of unpack_sdus() + SduReassembler.
+ *
+ * Usage: sdu_packer_bench [-n PDUs] [-c code rate]
+ */
+
+using namespace lib5grange;
+
+typedef struct{
+    unsigned pdus = 2000;
+    float coderate = 0.9f;
+}bench_cfg_t;
+
+int main(int argc, char ** argv){
+    bench_cfg_t cfg;
+    int opt;
+    while((opt = getopt(argc, argv, "n:c:h"))!=-1){
+        switch(opt){
+            case 'n': cfg.pdus = atoi(optarg); break;
+            case 'c': cfg.coderate = atof(optarg); break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-n PDUs] [-c code rate]" << endl;
+                return 1;
+        }
+    }
+    if(cfg.pdus<1) cfg.pdus = 1;
+    if(cfg.coderate<=0 || cfg.coderate>1) cfg.coderate = 0.9f;
+
+    allocation_cfg_t allocation;
+    allocation.target_ue_id = 1;
+    allocation.first_rb = 0;
+    allocation.number_of_rb = MAX_NUM_RB;
+    const size_t capacity = get_net_byte_capacity(0, allocation, mimo_cfg_t(), QAM256, cfg.coderate);
+    const size_t sduSizes[] = {64, 576, 1500, 9000, 65535};
+    mt19937 rng(1234);
+
+    printf("PDU capacity %zu bytes, %u PDUs per test\n", capacity, cfg.pdus);
+    printf("SDU bytes | SDUs/PDU | pack span (GB/s) | pack adopt (GB/s) | unpack (GB/s)\n");
+    for(size_t sduSize : sduSizes){
+        //Enough packets for all the PDUs, cycling over a pool of random payloads
+        const size_t numSDUs = (size_t(cfg.pdus)*capacity)/sduSize + 1;
+        vector<vector<uint8_t>> pool(16, vector<uint8_t>(sduSize));
+        for(auto & p : pool) for(auto & b : p) b = rng();
+
+        //Pack, SDUs as spans; keep every PDU for the unpack pass (buffers allocated before timing)
+        vector<vector<uint8_t>> pdus(cfg.pdus, vector<uint8_t>(capacity));
+        SduPacker spans;
+        for(size_t i=0;i<numSDUs;i++) spans.push({pool[i%pool.size()].data(), sduSize});
+        size_t packed = 0;
+        auto start = chrono::steady_clock::now();
+        for(auto & pdu : pdus) packed += spans.pack(pdu, capacity);
+        double spanSeconds = chrono::duration<double>(chrono::steady_clock::now()-start).count();
+
+        //Pack, SDUs adopted as vectors (the copies into the queue are made before timing)
+        SduPacker adopted;
+        for(size_t i=0;i<numSDUs;i++) adopted.push(vector<uint8_t>(pool[i%pool.size()]));
+        vector<uint8_t> macData;
+        size_t adoptedBytes = 0;
+        start = chrono::steady_clock::now();
+        for(unsigned i=0;i<cfg.pdus;i++) adoptedBytes += adopted.pack(macData, capacity);
+        double adoptSeconds = chrono::duration<double>(chrono::steady_clock::now()-start).count();
+
+        //Unpack and reassemble, checking the delivered packets
+        vector<sdu_segment_t> segments;
+        SduReassembler reassembler;
+        size_t delivered = 0, deliveredBytes = 0, errors = 0;
+        auto check = [&](const byte_span_t & sdu){
+            const vector<uint8_t> & expected = pool[delivered%pool.size()];
+            if(sdu.size!=sduSize || memcmp(sdu.data, expected.data(), sduSize)!=0) errors++;
+            delivered++;
+            deliveredBytes += sdu.size;
+        };
+        start = chrono::steady_clock::now();
+        for(auto & pdu : pdus){
+            if(!unpack_sdus(pdu, segments)) errors++;
+            errors += reassembler.push(segments, check);
+        }
+        double unpackSeconds = chrono::duration<double>(chrono::steady_clock::now()-start).count();
+        if(errors){
+            printf("%9zu | %zu errors in %zu delivered SDUs\n", sduSize, errors, delivered);
+            return 1;
+        }
+
+        printf("%9zu | %8.1f | %16.2f | %17.2f | %13.2f\n", sduSize, double(packed)/sduSize/cfg.pdus,
+               packed/spanSeconds/1e9, adoptedBytes/adoptSeconds/1e9, deliveredBytes/unpackSeconds/1e9);
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "../lib5grange/lib5grange.h"
+#include "../lib5grange/segmentation.h"
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+/* Benchmark of transport block segmentation and code block encoding.
+ *
+ * Encodes random transport blocks of several sizes at a fixed code rate with TransportBlockEncoder, first
+ * on the calling thread only and then on WorkStealingPools of 1, 2, 4... workers (up to -w), and reports
+ * the time per transport block, the information throughput and the speedup over the calling thread. The
+ * coded output of every pool is checked against the single-threaded one. Speedups only mean something
+ * on a machine with at least as many free cores as workers.
+ *
+ * Usage: segmentation_bench [-n iterations] [-c code rate] [-w max workers]
+ */
+
+using namespace lib5grange;
+
+typedef struct{
+    unsigned iterations = 200;
+    float coderate = 0.5f;
+    unsigned maxWorkers = thread::hardware_concurrency();
+}bench_cfg_t;
+
+int main(int argc, char ** argv){
+    bench_cfg_t cfg;
+    int opt;
+    while((opt = getopt(argc, argv, "n:c:w:h"))!=-1){
+        switch(opt){
+            case 'n': cfg.iterations = atoi(optarg); break;
+            case 'c': cfg.coderate = atof(optarg); break;
+            case 'w': cfg.maxWorkers = atoi(optarg); break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-n iterations] [-c code rate] [-w max workers]" << endl;
+                return 1;
+        }
+    }
+    if(cfg.iterations<1) cfg.iterations = 1;
+    if(cfg.coderate<=0 || cfg.coderate>1) cfg.coderate = 0.5f;
+
+    mt19937 rng(1234);
+    const size_t infoBytes[] = {256, 2048, 16384, 65536};
+
+    printf("Code rate %.2f, %u iterations, %u hardware threads\n", cfg.coderate, cfg.iterations, thread::hardware_concurrency());
+    printf("info bytes | blocks | workers | us/TB | Mbit/s | speedup\n");
+    for(size_t size : infoBytes){
+        vector<uint8_t> info(size);
+        for(auto & b : info) b = rng();
+        segmentation_t seg;
+        if(!compute_segmentation(size*8, size_t(size/cfg.coderate), cfg.coderate, seg)){
+            printf("%10zu | layout rejected\n", size);
+            continue;
+        }
+
+        vector<uint8_t> reference;
+        double serial = 0;
+        for(unsigned workers=0;workers<=cfg.maxWorkers;workers=workers ? 2*workers : 1){
+            unique_ptr<WorkStealingPool> pool(workers ? new WorkStealingPool(workers) : nullptr);
+            TransportBlockEncoder encoder(pool.get());
+            vector<uint8_t> coded;
+            encoder.encode(info, seg, coded);   //Warm up (grows the scratch buffers)
+            auto start = chrono::steady_clock::now();
+            for(unsigned i=0;i<cfg.iterations;i++)
+                encoder.encode(info, seg, coded);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now()-start).count() / cfg.iterations;
+            if(workers==0){
+                reference = coded;
+                serial = seconds;
+            }
+            else if(coded!=reference){
+                printf("%10zu | %6zu | %7u | output differs from the calling thread\n", size, seg.blocks.size(), workers);
+                return 1;
+            }
+            printf("%10zu | %6zu | %7u | %5.0f | %6.0f | %7.2f\n", size, seg.blocks.size(), workers,
+                   seconds*1e6, size*8/seconds/1e6, serial/seconds);
+        }
+    }
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "../lib5grange/lib5grange.h"
+#include "../lib5grange/sdu_packer.h"
 #include <vector>
 #include <iostream>
 
@@ -48,15 +49,16 @@ int main(void){
     lib5grange::MacPDU mac_pdu_packet;
 
     // popy config structs to the MacPDU object
+    mac_pdu_packet.numID_ = numerology_id;
     mac_pdu_packet.allocation_ = allocation_config;
     mac_pdu_packet.mimo_ = mimo_config;
     mac_pdu_packet.mcs_  = mcs_config; 
 
-    // Copy the data to the Object
-    mac_pdu_packet.mac_data_.resize(NUMBYTES);
-    for(int i=0; i<NUMBYTES; i++){
-        mac_pdu_packet.mac_data_[i] = bytes_to_be_sent[i];
-    }  
+    // Pack the data into the Object (up to its net capacity, with SDU subheaders)
+    SduPacker packer;
+    packer.push({(const uint8_t*) bytes_to_be_sent, NUMBYTES});
+    size_t packed = packer.pack(mac_pdu_packet, coderate);
+    std::cout << packed << " bytes packed, " << packer.pending_bytes() << " bytes left for the next PDU" << std::endl;
 
     std::vector<uint8_t> bytes_to_phy_process;         //  
     mac_pdu_packet.serialize(bytes_to_phy_process);    // Serialize object into a sequence of bytes
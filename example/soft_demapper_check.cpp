@@ -0,0 +1,119 @@
+#include "../lib5grange/lib5grange.h"
+#include "../lib5grange/grid_map.h"
+#include "../lib5grange/soft_demapper.h"
+#include <iostream>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+/* Consistency check of the soft demapper.
+ *
+ * 1. The dispatched soft_demap_maxlog() (AVX-512 / AVX2 kernels plus scalar tail, whichever the build
+ *    enables) against demap_maxlog_scalar() for every modulation and symbol counts covering all tails,
+ *    float and int8 outputs. Build with -mavx2 and with -mavx512f -mavx2 to check each SIMD path.
+ * 2. The per RB overloads on the data of a full band allocation of every numerology, in data_idx order:
+ *    every symbol must be demapped with the noise variance of the RB its subcarrier belongs to, recomputed
+ *    here from the grid index.
+ * Returns 1 on any mismatch.
+ *
+ * Usage: soft_demapper_check [-t tolerance]
+ */
+
+using namespace lib5grange;
+
+int main(int argc, char ** argv){
+    float tolerance = 1e-5f;
+    int opt;
+    while((opt = getopt(argc, argv, "t:h"))!=-1){
+        switch(opt){
+            case 't': tolerance = atof(optarg); break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-t tolerance]" << endl;
+                return 1;
+        }
+    }
+#if defined(__AVX512F__) && defined(__AVX2__)
+    printf("Kernels: AVX-512 + AVX2 + scalar\n");
+#elif defined(__AVX2__)
+    printf("Kernels: AVX2 + scalar\n");
+#else
+    printf("Kernels: scalar only (build with -mavx2 or -mavx512f -mavx2 to check the SIMD paths)\n");
+#endif
+
+    mt19937 rng(1234);
+    normal_distribution<float> gauss(0.0f, 0.7f);
+    const qammod_t mods[] = {QPSK, QAM16, QAM64, QAM256};
+    size_t failures = 0;
+
+    //1. Dispatch against the scalar kernel
+    for(qammod_t mod : mods){
+        const unsigned levels = mod/2;
+        const float s = qam_grid_scale(mod);
+        const float nv = 0.1f;
+        const float gain = 4.0f/(s*s*nv);
+        float maxErr = 0;
+        size_t int8Errors = 0;
+        for(size_t n=0;n<=3*DEMAP_BLOCK_SYMBOLS+9;n++){
+            vector<complex<float>> y(n);
+            for(auto & v : y) v = complex<float>(gauss(rng), gauss(rng));
+            vector<float> ref(n*mod), got(n*mod);
+            demap_maxlog_scalar(y.data(), n, levels, s, gain, ref.data());
+            soft_demap_maxlog(y.data(), n, mod, nv, got.data());
+            for(size_t i=0;i<ref.size();i++) maxErr = max(maxErr, fabsf(ref[i]-got[i])/max(1.0f, fabsf(ref[i])));
+
+            vector<int8_t> q(n*mod);
+            soft_demap_maxlog(y.data(), n, mod, nv, 0.5f, q.data());
+            for(size_t i=0;i<ref.size();i++){
+                float e = min(max(nearbyintf(ref[i]*0.5f), -float(LLR_INT8_MAX)), float(LLR_INT8_MAX));
+                if(fabsf(e - q[i])>1) int8Errors++;     //Rounding of values at .5 may differ by one
+            }
+        }
+        bool ok = maxErr<=tolerance && int8Errors==0;
+        printf("QAM%-3u: max relative error %.2e, int8 mismatches %zu %s\n", unsigned(1u<<mod), maxErr, int8Errors, ok ? "" : "FAILED");
+        failures += !ok;
+    }
+
+    //2. Per RB noise variance on grid-mapped data
+    for(size_t numID=0;numID<6;numID++){
+        allocation_cfg_t allocation;
+        allocation.target_ue_id = 1;
+        allocation.first_rb = 3;
+        allocation.number_of_rb = MAX_NUM_RB - 3;
+        auto map = GridMapCache::instance().get(numID, allocation);
+        const size_t n = map->data_idx.size();
+        const size_t k = numerology[numID].k, kon = numerology[numID].kon;
+        const size_t scPerRb = numerology[numID].subcarriers_per_rb;
+        const size_t firstSc = allocation.first_rb*scPerRb;
+
+        vector<float> noiseVar(allocation.number_of_rb);
+        for(auto & v : noiseVar) v = 0.01f + 0.5f*float(rng())/float(rng.max());
+        vector<complex<float>> y(n);
+        for(auto & v : y) v = complex<float>(gauss(rng), gauss(rng));
+        vector<float> llr;
+        vector<int8_t> llr8;
+        soft_demap_maxlog(y, QAM64, noiseVar, map->data_rb_runs, llr);
+        soft_demap_maxlog(y, QAM64, noiseVar, map->data_rb_runs, 0.25f, llr8);
+
+        size_t wrong = 0;
+        float ref[QAM64];
+        for(size_t i=0;i<n;i++){
+            size_t a = (map->data_idx[i] % k + kon/2) % k;
+            size_t rb = (a - firstSc)/scPerRb;
+            soft_demap_maxlog(&y[i], 1, QAM64, noiseVar[rb], ref);
+            bool bad = false;
+            for(unsigned b=0;b<QAM64;b++){
+                bad = bad || fabsf(ref[b]-llr[i*QAM64+b]) > tolerance*max(1.0f, fabsf(ref[b]));
+                float e = min(max(nearbyintf(ref[b]*0.25f), -float(LLR_INT8_MAX)), float(LLR_INT8_MAX));
+                bad = bad || fabsf(e - llr8[i*QAM64+b]) > 1;
+            }
+            wrong += bad;
+        }
+        printf("Numerology %zu: %zu data symbols in %zu RB runs, %zu demapped with the wrong RB noise %s\n",
+               numID, n, map->data_rb_runs.size(), wrong, wrong ? "FAILED" : "");
+        failures += wrong>0;
+    }
+    printf(failures ? "Mismatches found\n" : "All checks passed\n");
+    return failures ? 1 : 0;
+}
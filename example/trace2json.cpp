@@ -0,0 +1,28 @@
+#include "../libMac5gRange/trace_ring.h"
+#include <iostream>
+#include <fstream>
+
+/* Offline converter from a MAC trace dump (TraceBuffer::dump()) to Chrome/Perfetto JSON.
+ * Usage: trace2json <dump file> [output.json]
+ * Open the output in chrome://tracing or https://ui.perfetto.dev
+ */
+int main(int argc, char ** argv){
+    if(argc<2){
+        std::cerr << "Usage: " << argv[0] << " <dump file> [output.json]" << std::endl;
+        return 1;
+    }
+    long count;
+    if(argc>2){
+        std::ofstream out(argv[2]);
+        count = traceToChromeJson(argv[1], out);
+    }
+    else{
+        count = traceToChromeJson(argv[1], std::cout);
+    }
+    if(count<0){
+        std::cerr << argv[1] << " is not a trace dump" << std::endl;
+        return 1;
+    }
+    std::cerr << count << " records converted" << std::endl;
+    return 0;
+}
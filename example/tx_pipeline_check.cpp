@@ -0,0 +1,138 @@
+#include "../libMac5gRange/libMac5gRange.h"
+#include "../libMac5gRange/tx_pipeline.h"
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+/* Lifecycle check of TxPipeline.
+ *
+ * A three stage pipeline (source numbering PDUs by subframe, a stage dropping every subframe % 7 == 3, a sink
+ * recording what reaches it) is taken through START -> IDLE -> START -> STOP -> START -> IDLE -> STOP. The
+ * sink is slowed down before the first STOP, so STOP_MODE finds full queues; the second STOP comes from IDLE,
+ * where the first stage holds a free PDU. After every phase the check verifies that:
+ *  - IDLE_MODE pauses the source while the other stages drain;
+ *  - every PDU sent by the source and not dropped reached the sink, in order, after STOP_MODE;
+ *  - all pooled PDUs are back in the free queue after STOP_MODE (including the one the first stage held);
+ *  - the pipeline restarts after STOP_MODE.
+ * Returns 1 on any mismatch.
+ *
+ * Usage: tx_pipeline_check [-n PDUs per phase] [-p pool size] [-q queue capacity]
+ */
+
+typedef struct{
+    unsigned pdusPerPhase = 20000;
+    unsigned poolSize = 16;
+    unsigned queueCapacity = 4;
+}check_cfg_t;
+
+typedef struct{
+    atomic<unsigned> nextSubframe {0};
+    atomic<unsigned> received {0};
+    atomic<bool> slowSink {false};
+    vector<unsigned> sinkSubframes;     //Written by the sink thread only, read with the pipeline stopped
+}check_state_t;
+
+static bool waitFor(const atomic<unsigned> & counter, unsigned target){
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(20);
+    while(counter.load()<target){
+        if(chrono::steady_clock::now()>deadline) return false;
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    return true;
+}
+
+/** Checks the sink against the stage counters with the pipeline stopped **/
+static bool checkStopped(TxPipeline & pipeline, const check_state_t & state, const check_cfg_t & cfg, const char * phase){
+    PipelineStageStats source = pipeline.stats(0), filter = pipeline.stats(1), sink = pipeline.stats(2);
+    const char * error = NULL;
+    uint64_t expected = source.processed - source.dropped - filter.dropped;
+    if(pipeline.occupancy(0)!=cfg.poolSize) error = "PDUs missing from the pool";
+    else if(state.sinkSubframes.size()!=expected || sink.processed!=expected) error = "PDUs lost in the drain";
+    else{
+        for(size_t i=0;i<state.sinkSubframes.size() && !error;i++){
+            if(state.sinkSubframes[i]%7==3) error = "dropped PDU reached the sink";
+            else if(i>0 && state.sinkSubframes[i]<=state.sinkSubframes[i-1]) error = "PDUs out of order";
+        }
+    }
+    printf("%-18s source %8llu (%llu dropped on STOP) | filter dropped %6llu | sink %8llu | pool %zu/%u %s\n", phase,
+           (unsigned long long) source.processed, (unsigned long long) source.dropped, (unsigned long long) filter.dropped,
+           (unsigned long long) sink.processed, pipeline.occupancy(0), cfg.poolSize, error ? error : "");
+    return error==NULL;
+}
+
+int main(int argc, char ** argv){
+    check_cfg_t cfg;
+    int opt;
+    while((opt = getopt(argc, argv, "n:p:q:h"))!=-1){
+        switch(opt){
+            case 'n': cfg.pdusPerPhase = atoi(optarg); break;
+            case 'p': cfg.poolSize = atoi(optarg); break;
+            case 'q': cfg.queueCapacity = atoi(optarg); break;
+            default:
+                cerr << "Usage: " << argv[0] << " [-n PDUs per phase] [-p pool size] [-q queue capacity]" << endl;
+                return 1;
+        }
+    }
+    if(cfg.pdusPerPhase<1) cfg.pdusPerPhase = 1;
+    if(cfg.poolSize<1) cfg.poolSize = 1;
+    if(cfg.queueCapacity<1) cfg.queueCapacity = 1;
+
+    check_state_t state;
+    state.sinkSubframes.reserve(4*cfg.pdusPerPhase);
+    vector<PipelineStage> stages(3);
+    stages[0].name = "source";
+    stages[0].process = [&state](MacPDU & pdu){
+        pdu.macphy_ctl_.subframe_number = state.nextSubframe.fetch_add(1);
+        return true;
+    };
+    stages[1].name = "filter";
+    stages[1].process = [](MacPDU & pdu){
+        return pdu.macphy_ctl_.subframe_number%7!=3;
+    };
+    stages[2].name = "sink";
+    stages[2].process = [&state](MacPDU & pdu){
+        if(state.slowSink.load(memory_order_relaxed)) this_thread::sleep_for(chrono::microseconds(50));
+        state.sinkSubframes.push_back(pdu.macphy_ctl_.subframe_number);
+        state.received.fetch_add(1, memory_order_release);
+        return true;
+    };
+
+    bool ok = true;
+    {
+        TxPipeline pipeline(stages, cfg.poolSize, cfg.queueCapacity);
+
+        //START, then IDLE: the source pauses, the other stages drain
+        pipeline.setMode(START_MODE);
+        ok = ok && waitFor(state.received, cfg.pdusPerPhase);
+        pipeline.setMode(IDLE_MODE);
+        this_thread::sleep_for(chrono::milliseconds(50));
+        uint64_t idleSource = pipeline.stats(0).processed;
+        unsigned idleReceived = state.received.load();
+        this_thread::sleep_for(chrono::milliseconds(50));
+        bool paused = pipeline.stats(0).processed==idleSource && state.received.load()==idleReceived &&
+                      pipeline.occupancy(1)==0 && pipeline.occupancy(2)==0;
+        printf("%-18s source %8llu | sink %8u | %s\n", "START -> IDLE", (unsigned long long) idleSource,
+               idleReceived, paused ? "paused and drained" : "still running FAILED");
+        ok = ok && paused;
+
+        //START again, then STOP with a slow sink (full queues); restart, then STOP from IDLE (the first
+        //stage holds a free PDU while idle)
+        for(int round=0;round<2;round++){
+            pipeline.setMode(START_MODE);
+            ok = ok && waitFor(state.received, state.received.load() + cfg.pdusPerPhase);
+            if(round==0) state.slowSink.store(true);
+            else pipeline.setMode(IDLE_MODE);
+            this_thread::sleep_for(chrono::milliseconds(20));
+            pipeline.setMode(STOP_MODE);
+            state.slowSink.store(false);
+            ok = checkStopped(pipeline, state, cfg, round==0 ? "START -> STOP" : "restart/IDLE->STOP") && ok;
+        }
+    }
+    printf(ok ? "All checks passed\n" : "Mismatches found\n");
+    return ok ? 0 : 1;
+}
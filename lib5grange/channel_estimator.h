@@ -0,0 +1,283 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_LIB5GRANGE_CHANNEL_ESTIMATOR_H
+#define INCLUDED_LIB5GRANGE_CHANNEL_ESTIMATOR_H
+
+#include <cstdint>
+#include <cmath>
+#include <complex>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "lib5grange.h"
+#include "grid_map.h"
+
+/** SNR reported for a RB whose noise estimate is zero **/
+#define CHEST_MAX_SNR_DB (60.0f)
+
+namespace lib5grange {
+    using namespace std;
+
+    /**
+     * @brief Channel estimate of one allocation of a subframe.
+     *
+     * The estimate covers the whole allocation rectangle (pilot, DCI and data REs) in SoA layout:
+     * h_re/h_im[t*num_sc + s] is the channel on time slot t and subcarrier first_rb*subcarriers_per_rb + s.
+     */
+    typedef struct {
+        size_t numID;                   /**< Numerology ID **/
+        allocation_cfg_t allocation;    /**< Estimated allocation **/
+        size_t num_sc;                  /**< Subcarriers of the allocation **/
+        size_t num_slots;               /**< Time slots of the subframe **/
+        vector<float> h_re;             /**< Channel, real part ([slot][subcarrier]) **/
+        vector<float> h_im;             /**< Channel, imaginary part ([slot][subcarrier]) **/
+        vector<float> noise_var;        /**< Noise variance per RB (relative to unit energy symbols) **/
+        vector<float> snr_db;           /**< SNR per RB in dB (as in RxMetrics::snr) **/
+        float noise_var_avg;            /**< Noise variance over the allocation **/
+        float snr_avg_db;               /**< Average SNR in dB (as in RxMetrics::snr_avg) **/
+    } channel_estimate_t;
+
+    /**
+     * @brief Row interpolation dst = (1-w)*a + w*b, vectorized where AVX2 is available.
+     */
+    inline void chest_interpolate_row(const float * a, const float * b, float w, size_t n, float * dst)
+    {
+        size_t i = 0;
+#if defined(__AVX2__)
+        const __m256 vw = _mm256_set1_ps(w);
+        for (; i+8<=n; i+=8){
+            __m256 va = _mm256_loadu_ps(a+i);
+            __m256 vb = _mm256_loadu_ps(b+i);
+            _mm256_storeu_ps(dst+i, _mm256_add_ps(va, _mm256_mul_ps(vw, _mm256_sub_ps(vb, va))));
+        }
+#endif
+        for (; i<n; i++){
+            dst[i] = a[i] + w*(b[i]-a[i]);
+        }
+    }
+
+    /**
+     * @brief Linear interpolation between pilots spaced df apart: dst[j*df + o] = p[j] + (o/df)*(p[j+1]-p[j]).
+     *
+     * Writes (num_pilots-1)*df values. Where AVX2 is available and 2 <= df <= 8, the output is walked in
+     * periods of lcm(df, 8) values (df/gcd(df, 8) vectors, 8/gcd(df, 8) pilot intervals): each vector loads
+     * the pilots it spans once and spreads them over its lanes with a permute, using lane tables built per call.
+     */
+    inline void chest_interpolate_freq(const float * p, size_t num_pilots, size_t df, float * dst)
+    {
+        size_t j = 0;
+#if defined(__AVX2__)
+        if (df >= 2 && df <= 8){
+            size_t g = 8;
+            while (df % g != 0){g >>= 1;}
+            const size_t num_vec = df/g;            // Vectors per period
+            const size_t step = 8/g;                // Pilot intervals per period
+            alignas(32) int32_t lo[8][8];
+            alignas(32) float w[8][8];
+            size_t first[8];
+            for (size_t v=0; v<num_vec; v++){
+                first[v] = 8*v/df;
+                for (size_t l=0; l<8; l++){
+                    lo[v][l] = (8*v+l)/df - first[v];
+                    w[v][l] = float((8*v+l)%df) / df;
+                }
+            }
+            const __m256i one = _mm256_set1_epi32(1);
+            for (; j+first[num_vec-1]+8<=num_pilots; j+=step){
+                for (size_t v=0; v<num_vec; v++){
+                    __m256 vp = _mm256_loadu_ps(p + j + first[v]);
+                    __m256i vlo = _mm256_load_si256((const __m256i *) lo[v]);
+                    __m256 va = _mm256_permutevar8x32_ps(vp, vlo);
+                    __m256 vb = _mm256_permutevar8x32_ps(vp, _mm256_add_epi32(vlo, one));
+                    __m256 vw = _mm256_load_ps(w[v]);
+                    _mm256_storeu_ps(dst + j*df + 8*v, _mm256_add_ps(va, _mm256_mul_ps(vw, _mm256_sub_ps(vb, va))));
+                }
+            }
+        }
+#endif
+        for (; j+1<num_pilots; j++){
+            const float d = (p[j+1]-p[j]) / df;
+            for (size_t o=0; o<df; o++){
+                dst[j*df+o] = p[j] + o*d;
+            }
+        }
+    }
+
+    /**
+     * @brief Pilot-based channel estimator for one numerology and allocation.
+     *
+     * Pilots sit on the lattice of the numerology (see: is_pilot_re()): every pilot_df-th active subcarrier
+     * of every pilot_dt-th time slot. The estimator computes least-squares estimates on the pilots, fills the
+     * pilot slots by linear interpolation in frequency and the other slots by linear interpolation in time
+     * (holding the last pilot row/column past the lattice edge). In the same pass over the pilots it
+     * measures, per RB, the pilot power and the residual of each pilot against the average of its frequency
+     * neighbours; for a channel that is locally linear in frequency that residual has 1.5 times the
+     * variance of the LS noise, which gives the noise variance and SNR per RB.
+     */
+    class ChannelEstimator {
+        private:
+            size_t numID_;
+            allocation_cfg_t allocation_;
+            size_t num_sc_;
+            size_t num_slots_;
+            size_t df_;
+            size_t dt_;
+            size_t num_pilot_sc_;           /**< Pilot subcarriers of the allocation **/
+            size_t num_pilot_slots_;        /**< Pilot time slots of the subframe **/
+            vector<uint32_t> pilot_grid_;   /**< Grid index of each pilot, [pilot slot][pilot subcarrier] **/
+            vector<float> p_re_, p_im_;     /**< LS estimates on the pilots, same layout **/
+
+        public:
+            /**
+             * @brief Construct a new ChannelEstimator object
+             * @param numID: (0 - 5) Number identifying the 5G Range numerology according to D3.2.
+             * @param allocation: allocation to be estimated.
+             */
+            ChannelEstimator(const size_t & numID, const allocation_cfg_t & allocation)
+            : numID_(numID), allocation_(allocation)
+            {
+                const auto & k = numerology[numID].k;
+                const size_t sc_per_rb = numerology[numID].subcarriers_per_rb;
+                const size_t first_sc = allocation.first_rb * sc_per_rb;
+                df_ = numerology[numID].pilot_df;
+                dt_ = numerology[numID].pilot_dt;
+                num_sc_ = allocation.number_of_rb * sc_per_rb;
+                num_slots_ = get_num_time_slots(numID);
+                num_pilot_sc_ = (num_sc_ + df_ - 1) / df_;
+                num_pilot_slots_ = (num_slots_ + dt_ - 1) / dt_;
+                pilot_grid_.resize(num_pilot_sc_ * num_pilot_slots_);
+                for (size_t i=0; i<num_pilot_slots_; i++){
+                    for (size_t j=0; j<num_pilot_sc_; j++){
+                        size_t a = first_sc + j*df_;
+                        assert(is_pilot_re(numID, a, i*dt_));
+                        pilot_grid_[i*num_pilot_sc_ + j] = i*dt_*k + active_to_bin(numID, a);
+                    }
+                }
+                p_re_.resize(pilot_grid_.size());
+                p_im_.resize(pilot_grid_.size());
+            }
+
+            /**
+             * @brief Estimates the channel of the allocation from a received subframe grid
+             * @param grid: received grid of one antenna (get_grid_size(numID) REs, see: map_to_grid()).
+             * @param pilot: transmitted pilot value (must be non-zero and finite).
+             * @param est: output estimate.
+             * @return false if the pilot is zero or not finite (est is left untouched).
+             */
+            bool estimate(const complex<float> * grid, const complex<float> & pilot, channel_estimate_t & est)
+            {
+                const size_t sc_per_rb = numerology[numID_].subcarriers_per_rb;
+                const size_t num_rb = allocation_.number_of_rb;
+                const float pilot_power = norm(pilot);
+                if (!(pilot_power > 0) || !isfinite(pilot_power)){return false;}
+                const complex<float> inv_pilot = conj(pilot) / pilot_power;
+
+                est.numID = numID_;
+                est.allocation = allocation_;
+                est.num_sc = num_sc_;
+                est.num_slots = num_slots_;
+                est.h_re.resize(num_sc_ * num_slots_);
+                est.h_im.resize(num_sc_ * num_slots_);
+                est.noise_var.assign(num_rb, 0.0f);
+                est.snr_db.assign(num_rb, 0.0f);
+                vector<float> & power = est.snr_db;            // Pilot power accumulator, turned into SNR below
+                vector<float> residual_count(num_rb, 0.0f);
+
+                // LS estimates, per RB pilot power and neighbour residuals
+                for (size_t i=0; i<num_pilot_slots_; i++){
+                    float * pre = p_re_.data() + i*num_pilot_sc_;
+                    float * pim = p_im_.data() + i*num_pilot_sc_;
+                    const uint32_t * idx = pilot_grid_.data() + i*num_pilot_sc_;
+                    for (size_t j=0; j<num_pilot_sc_; j++){
+                        if (j + GRID_PREFETCH_DISTANCE < num_pilot_sc_){
+                            __builtin_prefetch(grid + idx[j+GRID_PREFETCH_DISTANCE], 0);
+                        }
+                        complex<float> h = grid[idx[j]] * inv_pilot;
+                        pre[j] = h.real();
+                        pim[j] = h.imag();
+                        power[j*df_/sc_per_rb] += pre[j]*pre[j] + pim[j]*pim[j];
+                    }
+                    for (size_t j=1; j+1<num_pilot_sc_; j++){
+                        float er = pre[j] - 0.5f*(pre[j-1] + pre[j+1]);
+                        float ei = pim[j] - 0.5f*(pim[j-1] + pim[j+1]);
+                        size_t rb = j*df_/sc_per_rb;
+                        est.noise_var[rb] += er*er + ei*ei;
+                        residual_count[rb] += 1.0f;
+                    }
+                }
+
+                // Noise variance and SNR per RB (LS noise variance = N0/|pilot|^2, N0 relative to unit energy)
+                float noise_sum = 0, residual_sum = 0;
+                for (size_t rb=0; rb<num_rb; rb++){
+                    noise_sum += est.noise_var[rb];
+                    residual_sum += residual_count[rb];
+                }
+                est.noise_var_avg = residual_sum > 0 ? noise_sum / (1.5f*residual_sum) : 0.0f;
+                float snr_sum = 0;
+                for (size_t rb=0; rb<num_rb; rb++){
+                    float pilots_in_rb = float(((rb+1)*sc_per_rb + df_-1)/df_ - (rb*sc_per_rb + df_-1)/df_) * num_pilot_slots_;
+                    float nv = residual_count[rb] > 0 ? est.noise_var[rb] / (1.5f*residual_count[rb]) : est.noise_var_avg;
+                    float signal = pilots_in_rb > 0 ? power[rb]/pilots_in_rb - nv : 0.0f;
+                    est.noise_var[rb] = nv;
+                    float snr = (nv > 0 && signal > 0) ? 10.0f*log10f(signal/nv) : (signal > 0 ? CHEST_MAX_SNR_DB : -CHEST_MAX_SNR_DB);
+                    est.snr_db[rb] = snr > CHEST_MAX_SNR_DB ? CHEST_MAX_SNR_DB : snr;
+                    snr_sum += est.snr_db[rb];
+                }
+                est.snr_avg_db = num_rb > 0 ? snr_sum / num_rb : 0.0f;
+
+                // Frequency interpolation on the pilot slots
+                for (size_t i=0; i<num_pilot_slots_; i++){
+                    const float * pre = p_re_.data() + i*num_pilot_sc_;
+                    const float * pim = p_im_.data() + i*num_pilot_sc_;
+                    float * hre = est.h_re.data() + i*dt_*num_sc_;
+                    float * him = est.h_im.data() + i*dt_*num_sc_;
+                    chest_interpolate_freq(pre, num_pilot_sc_, df_, hre);
+                    chest_interpolate_freq(pim, num_pilot_sc_, df_, him);
+                    for (size_t s=(num_pilot_sc_-1)*df_; s<num_sc_; s++){
+                        hre[s] = pre[num_pilot_sc_-1];
+                        him[s] = pim[num_pilot_sc_-1];
+                    }
+                }
+
+                // Time interpolation of the other slots
+                for (size_t t=0; t<num_slots_; t++){
+                    if (t % dt_ == 0){continue;}
+                    size_t t0 = (t/dt_)*dt_;
+                    size_t t1 = t0 + dt_;
+                    float w = float(t - t0) / dt_;
+                    if (t1 >= num_slots_){t1 = t0; w = 0;}
+                    chest_interpolate_row(&est.h_re[t0*num_sc_], &est.h_re[t1*num_sc_], w, num_sc_, &est.h_re[t*num_sc_]);
+                    chest_interpolate_row(&est.h_im[t0*num_sc_], &est.h_im[t1*num_sc_], w, num_sc_, &est.h_im[t*num_sc_]);
+                }
+                return true;
+            }
+
+            /**
+             * @brief Gathers the channel estimate of a set of grid REs (e.g. map.data_idx) in SoA layout
+             * @param est: estimate of the allocation the REs belong to.
+             * @param idx: grid indices (see: grid_map_t).
+             * @param h_re: output, real part (idx.size() values).
+             * @param h_im: output, imaginary part (idx.size() values).
+             */
+            void gather(const channel_estimate_t & est, const vector<uint32_t> & idx, float * h_re, float * h_im) const
+            {
+                const size_t k = numerology[numID_].k;
+                const size_t kon = numerology[numID_].kon;
+                const size_t first_sc = allocation_.first_rb * numerology[numID_].subcarriers_per_rb;
+                for (size_t i=0; i<idx.size(); i++){
+                    size_t t = idx[i] / k;
+                    size_t a = (idx[i] % k + kon/2) % k;   // Inverse of active_to_bin()
+                    size_t pos = t*num_sc_ + (a - first_sc);
+                    h_re[i] = est.h_re[pos];
+                    h_im[i] = est.h_im[pos];
+                }
+            }
+    }; /* class ChannelEstimator */
+
+} /* namespace lib5grange */
+#endif /* INCLUDED_LIB5GRANGE_CHANNEL_ESTIMATOR_H */
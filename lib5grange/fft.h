@@ -0,0 +1,110 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_LIB5GRANGE_FFT_H
+#define INCLUDED_LIB5GRANGE_FFT_H
+
+#include <cstdint>
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <algorithm>
+
+namespace lib5grange {
+    using namespace std;
+
+    /**
+     * @brief Precomputed plan for a radix-2 FFT of power of two length.
+     *
+     * Twiddle factors are stored stage after stage so every butterfly stage reads them contiguously,
+     * and the bit reversal permutation is computed once. Transforms are unitary (scaled by 1/sqrt(n))
+     * unless requested otherwise.
+     */
+    class FFTPlan {
+        private:
+            size_t n_;
+            bool inverse_;
+            float scale_;
+            vector<complex<float>> twiddles_;   /**< Stage h uses twiddles_[h-1 .. 2h-2] **/
+            vector<uint32_t> bitrev_;
+
+            void butterflies(complex<float> * x) const {
+                for (size_t h=1; h<n_; h<<=1){
+                    const complex<float> * w = twiddles_.data() + h - 1;
+                    for (size_t i=0; i<n_; i+=2*h){
+                        complex<float> * a = x + i;
+                        complex<float> * b = x + i + h;
+                        for (size_t j=0; j<h; j++){
+                            // Explicit product avoids the NaN/Inf recovery path of complex operator*
+                            const float br = b[j].real(), bi = b[j].imag();
+                            const float wr = w[j].real(), wi = w[j].imag();
+                            const complex<float> t(br*wr - bi*wi, br*wi + bi*wr);
+                            b[j] = a[j] - t;
+                            a[j] = a[j] + t;
+                        }
+                    }
+                }
+                if (scale_ != 1.0f){
+                    for (size_t i=0; i<n_; i++){
+                        x[i] *= scale_;
+                    }
+                }
+            }
+
+        public:
+            /**
+             * @brief Construct a new FFT plan
+             * @param n: transform length (power of two).
+             * @param inverse: true for the inverse transform (positive exponent).
+             * @param unitary: scale the output by 1/sqrt(n).
+             */
+            FFTPlan(size_t n, bool inverse, bool unitary = true)
+            : n_(n), inverse_(inverse), scale_(unitary ? float(1.0/sqrt(double(n))) : 1.0f)
+            {
+                unsigned log2n = 0;
+                while ((size_t(1)<<log2n) < n_){log2n++;}
+                bitrev_.resize(n_);
+                for (size_t i=0; i<n_; i++){
+                    uint32_t r = 0;
+                    for (unsigned b=0; b<log2n; b++){
+                        r |= ((i>>b)&1) << (log2n-1-b);
+                    }
+                    bitrev_[i] = r;
+                }
+                twiddles_.resize(n_ > 1 ? n_-1 : 0);
+                const double sign = inverse_ ? 1.0 : -1.0;
+                for (size_t h=1; h<n_; h<<=1){
+                    for (size_t j=0; j<h; j++){
+                        double phase = sign*M_PI*double(j)/double(h);
+                        twiddles_[h-1+j] = complex<float>(cos(phase), sin(phase));
+                    }
+                }
+            }
+
+            /** @brief Transform length **/
+            size_t size() const {return n_;}
+
+            /** @brief In-place transform **/
+            void execute(complex<float> * x) const {
+                for (size_t i=0; i<n_; i++){
+                    if (i < bitrev_[i]){
+                        swap(x[i], x[bitrev_[i]]);
+                    }
+                }
+                butterflies(x);
+            }
+
+            /** @brief Out-of-place transform (in and out must not overlap) **/
+            void execute(const complex<float> * in, complex<float> * out) const {
+                for (size_t i=0; i<n_; i++){
+                    out[bitrev_[i]] = in[i];
+                }
+                butterflies(out);
+            }
+    }; /* class FFTPlan */
+
+} /* namespace lib5grange */
+#endif /* INCLUDED_LIB5GRANGE_FFT_H */
@@ -0,0 +1,348 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_LIB5GRANGE_GFDM_MODEM_H
+#define INCLUDED_LIB5GRANGE_GFDM_MODEM_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <array>
+#include <memory>
+#include <chrono>
+#include <ostream>
+#include "lib5grange.h"
+#include "grid_map.h"
+#include "fft.h"
+#include "work_stealing_pool.h"
+
+/** Frequency domain oversampling of the GFDM prototype filter **/
+#define GFDM_FILTER_OVERSAMPLING (2)
+
+/** Largest number of subsymbols (m) of a GFDM block **/
+#define GFDM_MAX_SUBSYMBOLS (8)
+
+/** Number of 5G Range numerologies **/
+#define NUM_NUMEROLOGIES (6)
+
+namespace lib5grange {
+    using namespace std;
+
+    /** Processing time accounting of a modulator or demodulator **/
+    typedef struct {
+        uint64_t subframes = 0;         /**< Number of processed subframes **/
+        double processing_time = 0;     /**< Wall clock time spent processing (s) **/
+        double air_time = 0;            /**< Air time of the processed subframes (s) **/
+
+        /** Processing time over air time (below 1 means faster than real time) **/
+        double real_time_factor() const {
+            return air_time > 0 ? processing_time/air_time : 0;
+        }
+    } modem_stats_t;
+
+    /**
+     * @brief GFDM/OFDM modulator and demodulator for one numerology.
+     *
+     * Works on the subframe grid of grid_map.h (symbols_per_subframe blocks of m time slots by k bins).
+     * GFDM blocks are modulated in the frequency domain: each subcarrier is transformed with an m-point FFT,
+     * repeated GFDM_FILTER_OVERSAMPLING times, shaped by the raised-cosine prototype filter (roll-off a) and
+     * added at its position of a k*m-point spectrum, which is then taken to time with one IFFT. Each block
+     * gets ncp samples of CP and ncs samples of CS, and its edges are shaped by a raised-cosine window of
+     * nw samples. In OFDM mode every time slot is one OFDM symbol with ncp/m, ncs/m and nw/m samples of CP,
+     * CS and window, so both modes have the same subframe length.
+     * The receiver uses the matched filter, which is the exact inverse for a = 0.
+     * FFT plans, filter and windows are computed in the constructor. Blocks are spread over a persistent
+     * WorkStealingPool when one is given (no threads are created per subframe), otherwise they run on the
+     * calling thread.
+     */
+    class GfdmModem {
+        private:
+            size_t numID_;
+            size_t k_, m_, n_, ncp_, ncs_, nw_;
+            WorkStealingPool * pool_;
+            FFTPlan fft_m_, ifft_m_, fft_n_, ifft_n_, fft_k_, ifft_k_;
+            vector<float> filter_;                      /**< Prototype filter, bins -L*m/2 .. L*m/2-1 **/
+            vector<float> window_;                      /**< GFDM block ramp (nw samples) **/
+            vector<float> ofdm_window_;                 /**< OFDM symbol ramp (nw/m samples) **/
+            vector<vector<complex<float>>> scratch_;    /**< One n-sample buffer per chunk of blocks **/
+            modem_stats_t tx_stats_, rx_stats_;
+
+            static void make_ramp(vector<float> & ramp, size_t len){
+                ramp.resize(len);
+                for (size_t i=0; i<len; i++){
+                    ramp[i] = 0.5f*(1.0f - cosf(float(M_PI)*(float(i)+0.5f)/float(len)));
+                }
+            }
+
+            static void apply_window(complex<float> * x, size_t len, const vector<float> & ramp){
+                const size_t nw = ramp.size();
+                for (size_t i=0; i<nw; i++){
+                    x[i] *= ramp[i];
+                    x[len-1-i] *= ramp[i];
+                }
+            }
+
+            size_t block_samples() const {return n_ + ncp_ + ncs_;}
+
+            /**
+             * Runs fn(block, chunk) for all blocks of the subframe. Blocks are dealt into scratch_.size()
+             * interleaved chunks, one pool iteration each, so a chunk (and its scratch buffer) is only used
+             * by one thread at a time.
+             */
+            template <typename F>
+            void for_each_block(F fn){
+                const size_t num_blocks = numerology[numID_].symbols_per_subframe;
+                const size_t nc = min(scratch_.size(), num_blocks);
+                auto run_chunk = [&](size_t c){
+                    for (size_t b=c; b<num_blocks; b+=nc){fn(b, c);}
+                };
+                if (pool_ == nullptr || nc <= 1){
+                    for (size_t c=0; c<nc; c++){run_chunk(c);}
+                    return;
+                }
+                pool_->parallel_for(nc, run_chunk);
+            }
+
+            void modulate_gfdm_block(const complex<float> * grid, complex<float> * out, complex<float> * spectrum){
+                const size_t lm = GFDM_FILTER_OVERSAMPLING*m_;
+                complex<float> d[GFDM_MAX_SUBSYMBOLS], D[GFDM_MAX_SUBSYMBOLS];
+                memset((void*) spectrum, 0, n_*sizeof(complex<float>));
+                for (size_t kk=0; kk<k_; kk++){
+                    bool empty = true;
+                    for (size_t mm=0; mm<m_; mm++){
+                        d[mm] = grid[mm*k_ + kk];
+                        empty = empty && (d[mm] == complex<float>(0, 0));
+                    }
+                    if (empty){continue;}
+                    fft_m_.execute(d, D);
+                    for (size_t i=0; i<lm; i++){
+                        if (filter_[i] == 0){continue;}
+                        long u = long(i) - long(lm/2);
+                        size_t f = (kk*m_ + n_ + u) % n_;
+                        spectrum[f] += filter_[i] * D[size_t(u + long(lm)) % m_];
+                    }
+                }
+                ifft_n_.execute(spectrum, out + ncp_);
+                memcpy((void*) out, out + n_, ncp_*sizeof(complex<float>));
+                memcpy((void*) (out + ncp_ + n_), out + ncp_, ncs_*sizeof(complex<float>));
+                apply_window(out, block_samples(), window_);
+            }
+
+            void demodulate_gfdm_block(const complex<float> * in, complex<float> * grid, complex<float> * spectrum){
+                const size_t lm = GFDM_FILTER_OVERSAMPLING*m_;
+                complex<float> d[GFDM_MAX_SUBSYMBOLS], D[GFDM_MAX_SUBSYMBOLS];
+                fft_n_.execute(in + ncp_, spectrum);
+                for (size_t kk=0; kk<k_; kk++){
+                    for (size_t mm=0; mm<m_; mm++){D[mm] = 0;}
+                    for (size_t i=0; i<lm; i++){
+                        if (filter_[i] == 0){continue;}
+                        long u = long(i) - long(lm/2);
+                        size_t f = (kk*m_ + n_ + u) % n_;
+                        D[size_t(u + long(lm)) % m_] += filter_[i] * spectrum[f];
+                    }
+                    ifft_m_.execute(D, d);
+                    for (size_t mm=0; mm<m_; mm++){
+                        grid[mm*k_ + kk] = d[mm];
+                    }
+                }
+            }
+
+            void modulate_ofdm_block(const complex<float> * grid, complex<float> * out){
+                const size_t cp = ncp_/m_, cs = ncs_/m_, len = k_ + cp + cs;
+                for (size_t mm=0; mm<m_; mm++){
+                    complex<float> * sym = out + mm*len;
+                    ifft_k_.execute(grid + mm*k_, sym + cp);
+                    memcpy((void*) sym, sym + k_, cp*sizeof(complex<float>));
+                    memcpy((void*) (sym + cp + k_), sym + cp, cs*sizeof(complex<float>));
+                    apply_window(sym, len, ofdm_window_);
+                }
+            }
+
+            void demodulate_ofdm_block(const complex<float> * in, complex<float> * grid){
+                const size_t cp = ncp_/m_, cs = ncs_/m_, len = k_ + cp + cs;
+                for (size_t mm=0; mm<m_; mm++){
+                    fft_k_.execute(in + mm*len + cp, grid + mm*k_);
+                }
+            }
+
+        public:
+            /**
+             * @brief Construct a new GfdmModem object
+             * @param numID: (0 - 5) Number identifying the 5G Range numerology according to D3.2.
+             * @param pool: pool sharing the blocks of a subframe (nullptr for the calling thread only).
+             */
+            GfdmModem(size_t numID, WorkStealingPool * pool = nullptr)
+            : numID_(numID),
+              k_(numerology[numID].k), m_(numerology[numID].m), n_(k_*m_),
+              ncp_(numerology[numID].ncp), ncs_(numerology[numID].ncs), nw_(numerology[numID].nw),
+              pool_(pool),
+              fft_m_(m_, false), ifft_m_(m_, true),
+              fft_n_(n_, false), ifft_n_(n_, true),
+              fft_k_(k_, false), ifft_k_(k_, true)
+            {
+                // Raised-cosine prototype filter, normalized to m units of energy
+                const size_t lm = GFDM_FILTER_OVERSAMPLING*m_;
+                const float a = numerology[numID].a;
+                filter_.resize(lm);
+                float energy = 0;
+                for (size_t i=0; i<lm; i++){
+                    float u = (float(i) - float(lm/2))/float(m_);
+                    float au = fabsf(u);
+                    if (a <= 0){
+                        filter_[i] = (u >= -0.5f && u < 0.5f) ? 1.0f : 0.0f;
+                    }
+                    else if (au <= (1-a)/2){
+                        filter_[i] = 1.0f;
+                    }
+                    else if (au <= (1+a)/2){
+                        filter_[i] = 0.5f*(1.0f + cosf(float(M_PI)/a*(au - (1-a)/2)));
+                    }
+                    else{
+                        filter_[i] = 0.0f;
+                    }
+                    energy += filter_[i]*filter_[i];
+                }
+                for (auto & g : filter_){g *= sqrtf(float(m_)/energy);}
+
+                make_ramp(window_, nw_);
+                make_ramp(ofdm_window_, nw_/m_);
+                // Workers plus the calling thread, no more than there are blocks
+                size_t num_chunks = pool_ != nullptr ? pool_->size() + 1 : 1;
+                num_chunks = min<size_t>(num_chunks, numerology[numID].symbols_per_subframe);
+                scratch_.resize(num_chunks);
+                for (auto & s : scratch_){s.resize(n_);}
+            }
+
+            /** @brief Numerology ID **/
+            size_t numID() const {return numID_;}
+
+            /**
+             * @brief Modulates one subframe
+             * @param grid: subframe grid with get_grid_size(numID) REs.
+             * @param ofdm_gfdm: waveform (0=OFDM; 1=GFDM), as in BSSubframeTx_Start.
+             * @param samples: output with get_subframe_samples(numID) samples.
+             */
+            void modulate(const complex<float> * grid, uint8_t ofdm_gfdm, complex<float> * samples){
+                auto start = chrono::steady_clock::now();
+                for_each_block([&](size_t b, unsigned t){
+                    const complex<float> * g = grid + b*m_*k_;
+                    complex<float> * out = samples + b*block_samples();
+                    if (ofdm_gfdm){
+                        modulate_gfdm_block(g, out, scratch_[t].data());
+                    }
+                    else{
+                        modulate_ofdm_block(g, out);
+                    }
+                });
+                chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+                tx_stats_.subframes++;
+                tx_stats_.processing_time += elapsed.count();
+                tx_stats_.air_time += get_subframe_duration(numID_);
+            }
+
+            /**
+             * @brief Demodulates one (synchronized) subframe
+             * @param samples: get_subframe_samples(numID) received samples.
+             * @param ofdm_gfdm: waveform (0=OFDM; 1=GFDM).
+             * @param grid: output grid with get_grid_size(numID) REs.
+             */
+            void demodulate(const complex<float> * samples, uint8_t ofdm_gfdm, complex<float> * grid){
+                auto start = chrono::steady_clock::now();
+                for_each_block([&](size_t b, unsigned t){
+                    const complex<float> * in = samples + b*block_samples();
+                    complex<float> * g = grid + b*m_*k_;
+                    if (ofdm_gfdm){
+                        demodulate_gfdm_block(in, g, scratch_[t].data());
+                    }
+                    else{
+                        demodulate_ofdm_block(in, g);
+                    }
+                });
+                chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+                rx_stats_.subframes++;
+                rx_stats_.processing_time += elapsed.count();
+                rx_stats_.air_time += get_subframe_duration(numID_);
+            }
+
+            /** @brief Vector version of modulate() (samples is resized) **/
+            void modulate(const vector<complex<float>> & grid, uint8_t ofdm_gfdm, vector<complex<float>> & samples){
+                samples.resize(get_subframe_samples(numID_));
+                modulate(grid.data(), ofdm_gfdm, samples.data());
+            }
+
+            /** @brief Vector version of demodulate() (grid is resized) **/
+            void demodulate(const vector<complex<float>> & samples, uint8_t ofdm_gfdm, vector<complex<float>> & grid){
+                grid.resize(get_grid_size(numID_));
+                demodulate(samples.data(), ofdm_gfdm, grid.data());
+            }
+
+            /** @brief Modulator statistics **/
+            const modem_stats_t & tx_stats() const {return tx_stats_;}
+
+            /** @brief Demodulator statistics **/
+            const modem_stats_t & rx_stats() const {return rx_stats_;}
+
+            /** @brief Clears the statistics **/
+            void reset_stats(){
+                tx_stats_ = modem_stats_t();
+                rx_stats_ = modem_stats_t();
+            }
+    }; /* class GfdmModem */
+
+    /**
+     * @brief Set of modems for all numerologies, built once at construction.
+     *
+     * A modem must not be used by two threads at the same time; each one already spreads its blocks over
+     * the pool of the engine, which is created once and shared by all modems.
+     */
+    class ModemEngine {
+        private:
+            unique_ptr<WorkStealingPool> pool_;     // Declared first: outlives the modems using it
+            array<unique_ptr<GfdmModem>, NUM_NUMEROLOGIES> modems_;
+
+        public:
+            /**
+             * @brief Construct a new ModemEngine object
+             * @param num_threads: number of threads sharing the blocks of a subframe (the caller included).
+             */
+            ModemEngine(unsigned num_threads = 1){
+                if (num_threads > 1){
+                    pool_.reset(new WorkStealingPool(num_threads - 1));
+                }
+                for (size_t i=0; i<NUM_NUMEROLOGIES; i++){
+                    modems_[i].reset(new GfdmModem(i, pool_.get()));
+                }
+            }
+
+            /** @brief Modem of a numerology **/
+            GfdmModem & modem(size_t numID){return *modems_[numID];}
+
+            /** @brief Modulates one subframe with the given numerology and waveform (see: GfdmModem::modulate()) **/
+            void modulate(size_t numID, uint8_t ofdm_gfdm, const vector<complex<float>> & grid, vector<complex<float>> & samples){
+                modems_[numID]->modulate(grid, ofdm_gfdm, samples);
+            }
+
+            /** @brief Demodulates one subframe with the given numerology and waveform (see: GfdmModem::demodulate()) **/
+            void demodulate(size_t numID, uint8_t ofdm_gfdm, const vector<complex<float>> & samples, vector<complex<float>> & grid){
+                modems_[numID]->demodulate(samples, ofdm_gfdm, grid);
+            }
+
+            /** @brief Prints the real-time factor of every numerology **/
+            void print_stats(ostream & os) const {
+                for (size_t i=0; i<NUM_NUMEROLOGIES; i++){
+                    const auto & tx = modems_[i]->tx_stats();
+                    const auto & rx = modems_[i]->rx_stats();
+                    os << "Numerology " << i
+                       << ": TX " << tx.subframes << " subframes, RTF " << tx.real_time_factor()
+                       << " | RX " << rx.subframes << " subframes, RTF " << rx.real_time_factor() << endl;
+                }
+            }
+    }; /* class ModemEngine */
+
+} /* namespace lib5grange */
+#endif /* INCLUDED_LIB5GRANGE_GFDM_MODEM_H */
@@ -0,0 +1,314 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_LIB5GRANGE_GRID_MAP_H
+#define INCLUDED_LIB5GRANGE_GRID_MAP_H
+
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <complex>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include "lib5grange.h"
+
+/** Distance (in REs) of the software prefetch issued by the grid mappers **/
+#define GRID_PREFETCH_DISTANCE (16)
+
+namespace lib5grange {
+    using namespace std;
+
+    /**
+     * Resource grid layout used by the mappers:
+     * A subframe has (m * symbols_per_subframe) time slots (one per subsymbol) of k subcarriers each,
+     * stored time slot after time slot: index = slot*k + bin.
+     * Active subcarrier a (0 <= a < kon) is placed on FFT bin (a + k - kon/2) % k, i.e. the active band
+     * is centered on DC. RB r covers active subcarriers [r*subcarriers_per_rb, (r+1)*subcarriers_per_rb).
+     */
+
+    /** @brief Number of time slots (subsymbols) in a subframe for a given numerology **/
+    inline size_t get_num_time_slots(const size_t & numID)
+    {
+        return numerology[numID].m * numerology[numID].symbols_per_subframe;
+    }
+
+    /** @brief Number of REs (active and inactive) of the k x m grid of a whole subframe **/
+    inline size_t get_grid_size(const size_t & numID)
+    {
+        return numerology[numID].k * get_num_time_slots(numID);
+    }
+
+    /** @brief FFT bin of the active subcarrier a **/
+    inline size_t active_to_bin(const size_t & numID, size_t a)
+    {
+        const auto & k   = numerology[numID].k;
+        const auto & kon = numerology[numID].kon;
+        return (a + k - kon/2) % k;
+    }
+
+    /** @brief Indicates if the RE on active subcarrier a and time slot t carries a pilot **/
+    inline bool is_pilot_re(const size_t & numID, size_t a, size_t t)
+    {
+        return ((a % numerology[numID].pilot_df)==0) && ((t % numerology[numID].pilot_dt)==0);
+    }
+
+    /** Contiguous run of data REs in the grid **/
+    typedef struct {
+        uint32_t offset;    /**< Grid index of the first RE **/
+        uint32_t length;    /**< Number of consecutive REs **/
+    } grid_run_t;
+
+    /** Run of consecutive data symbols (in data_idx order) that belong to the same RB **/
+    typedef struct {
+        uint32_t first;     /**< Index of the first symbol in data_idx order **/
+        uint32_t length;    /**< Number of symbols **/
+        uint32_t rb;        /**< RB of the symbols, relative to allocation.first_rb **/
+    } grid_rb_run_t;
+
+    /**
+     * @brief RE positions of one allocation in the subframe grid.
+     *
+     * All index arrays are sorted in increasing grid order, so scattering walks the grid linearly.
+     * Data and control symbols are mapped in that same order. Data symbols therefore come time slot after
+     * time slot, not RB after RB, and RBs hold different numbers of them (the DCI takes the first
+     * subcarriers of every NUM_RB_PER_DCI group); data_rb_runs gives the RB of every data symbol.
+     */
+    typedef struct {
+        size_t numID;                       /**< Numerology ID **/
+        allocation_cfg_t allocation;        /**< Allocation the map was built for **/
+        vector<uint32_t> data_idx;          /**< Grid index of each data RE **/
+        vector<grid_run_t> data_runs;       /**< data_idx as runs of consecutive REs **/
+        vector<grid_rb_run_t> data_rb_runs; /**< data_idx as runs of symbols of one RB, covering all of it **/
+        vector<uint32_t> pilot_idx;         /**< Grid index of each pilot RE **/
+        vector<uint32_t> dci_idx;           /**< Grid index of each DCI RE **/
+    } grid_map_t;
+
+    /**
+     * @brief Builds the RE map of an allocation.
+     *
+     * Consistency with get_re_capacity(): subcarriers_per_rb is a multiple of pilot_df and the number of
+     * time slots is a multiple of pilot_dt for every numerology, so each RB holds exactly numRE/(df*dt)
+     * pilots. Each group of NUM_RB_PER_DCI RBs starts with one DCI made of the first num_dci_sc
+     * subcarriers over all time slots minus their pilots, which is num_dci_qam REs. The data map therefore
+     * holds numRB*(numRE - numRE/(df*dt)) - num_dci_qam*(1 + (numRB-1)/NUM_RB_PER_DCI) REs, which is the
+     * SISO value of get_re_capacity() (MULTIPLEXING reuses the same map on every layer).
+     *
+     * @param numID: (0 - 5) Number identifying the 5G Range numerology according to D3.2.
+     * @param allocation: Struct with the configuration of the resource allocation (see: allocation_cfg_t).
+     * @param map: struct where the map is stored.
+     */
+    inline void build_grid_map(const size_t & numID, const allocation_cfg_t & allocation, grid_map_t & map)
+    {
+        const auto & k         = numerology[numID].k;
+        const auto & sc_per_rb = numerology[numID].subcarriers_per_rb;
+        const auto & dci_sc    = numerology[numID].num_dci_sc;
+        const size_t num_slots = get_num_time_slots(numID);
+        const size_t first_sc  = allocation.first_rb * sc_per_rb;
+        const size_t num_sc    = allocation.number_of_rb * sc_per_rb;
+        assert(allocation.first_rb + allocation.number_of_rb <= MAX_NUM_RB);
+
+        map.numID = numID;
+        map.allocation = allocation;
+        map.data_idx.clear();
+        map.data_runs.clear();
+        map.data_rb_runs.clear();
+        map.pilot_idx.clear();
+        map.dci_idx.clear();
+        map.data_idx.reserve(get_re_capacity(numID, allocation));
+
+        for (size_t t=0; t<num_slots; t++){
+            for (size_t a=first_sc; a<first_sc+num_sc; a++){
+                uint32_t idx = t*k + active_to_bin(numID, a);
+                size_t sc_in_group = (a-first_sc) % (NUM_RB_PER_DCI*sc_per_rb);
+                if (is_pilot_re(numID, a, t)){
+                    map.pilot_idx.push_back(idx);
+                }
+                else if (sc_in_group < dci_sc){
+                    map.dci_idx.push_back(idx);
+                }
+                else{
+                    map.data_idx.push_back(idx);
+                }
+            }
+        }
+
+        // The active band wraps around DC, so sort to get a linear walk over the grid
+        sort(map.data_idx.begin(), map.data_idx.end());
+        sort(map.pilot_idx.begin(), map.pilot_idx.end());
+        sort(map.dci_idx.begin(), map.dci_idx.end());
+
+        for (size_t i=0; i<map.data_idx.size(); i++){
+            if (!map.data_runs.empty()){
+                grid_run_t & last = map.data_runs.back();
+                if (last.offset + last.length == map.data_idx[i]){
+                    last.length++;
+                    continue;
+                }
+            }
+            map.data_runs.push_back({map.data_idx[i], 1});
+        }
+
+        const size_t kon = numerology[numID].kon;
+        for (size_t i=0; i<map.data_idx.size(); i++){
+            size_t a = (map.data_idx[i] % k + kon/2) % k;  // Inverse of active_to_bin()
+            uint32_t rb = (a - first_sc) / sc_per_rb;
+            if (!map.data_rb_runs.empty() && map.data_rb_runs.back().rb == rb){
+                map.data_rb_runs.back().length++;
+                continue;
+            }
+            map.data_rb_runs.push_back({uint32_t(i), 1, rb});
+        }
+        assert(map.data_idx.size() == get_re_capacity(numID, allocation));
+    }
+
+    /**
+     * @brief Thread-safe cache of grid maps, built lazily once per (numerology, first_rb, number_of_rb).
+     *
+     * Returned maps are immutable and stay valid while referenced, even after clear().
+     */
+    class GridMapCache {
+        private:
+            mutex mtx_;
+            map<uint32_t, shared_ptr<const grid_map_t>> maps_;
+
+            static uint32_t key(const size_t & numID, const allocation_cfg_t & allocation){
+                return (uint32_t(numID)<<16) | (uint32_t(allocation.first_rb)<<8) | allocation.number_of_rb;
+            }
+
+        public:
+            /** @brief Returns the map of the allocation, building it on first use **/
+            shared_ptr<const grid_map_t> get(const size_t & numID, const allocation_cfg_t & allocation){
+                const uint32_t k = key(numID, allocation);
+                lock_guard<mutex> lock(mtx_);
+                auto it = maps_.find(k);
+                if (it != maps_.end()){
+                    return it->second;
+                }
+                auto m = make_shared<grid_map_t>();
+                build_grid_map(numID, allocation, *m);
+                maps_[k] = m;
+                return m;
+            }
+
+            /** @brief Get the map from PDU object **/
+            shared_ptr<const grid_map_t> get(const MacPDU & pdu){
+                return get(pdu.numID_, pdu.allocation_);
+            }
+
+            /** @brief Number of cached maps **/
+            size_t size(){
+                lock_guard<mutex> lock(mtx_);
+                return maps_.size();
+            }
+
+            /** @brief Drops all cached maps **/
+            void clear(){
+                lock_guard<mutex> lock(mtx_);
+                maps_.clear();
+            }
+
+            /** @brief Process-wide cache instance **/
+            static GridMapCache & instance(){
+                static GridMapCache cache;
+                return cache;
+            }
+    }; /* class GridMapCache */
+
+    /**
+     * @brief Scatters data, control and pilot symbols into the subframe grid of one antenna.
+     *
+     * @param map: RE map of the allocation (see: build_grid_map()).
+     * @param data: data symbols, map.data_idx.size() of them.
+     * @param control: DCI symbols, map.dci_idx.size() of them (may be nullptr).
+     * @param pilot: value written on every pilot RE.
+     * @param grid: subframe grid with get_grid_size(numID) elements.
+     */
+    inline void map_to_grid(
+        const grid_map_t & map,
+        const complex<float> * data,
+        const complex<float> * control,
+        const complex<float> & pilot,
+        complex<float> * grid)
+    {
+        const complex<float> * src = data;
+        for (const auto & run : map.data_runs){
+            memcpy(grid + run.offset, src, run.length*sizeof(complex<float>));
+            src += run.length;
+        }
+        if (control != nullptr){
+            const size_t n = map.dci_idx.size();
+            for (size_t i=0; i<n; i++){
+                if (i + GRID_PREFETCH_DISTANCE < n){
+                    __builtin_prefetch(grid + map.dci_idx[i+GRID_PREFETCH_DISTANCE], 1);
+                }
+                grid[map.dci_idx[i]] = control[i];
+            }
+        }
+        for (const auto & idx : map.pilot_idx){
+            grid[idx] = pilot;
+        }
+    }
+
+    /**
+     * @brief Maps the symbols of a PDU onto the grids of its antennas.
+     *
+     * SISO and DIVERSITY PDUs use symbols_ (or mimo_symbols_ when filled) and control_symbols_;
+     * MULTIPLEXING PDUs take one data layer per antenna from mimo_symbols_.
+     *
+     * @param map: RE map of the PDU allocation.
+     * @param pdu: MacPDU object with the symbols to be transmitted.
+     * @param grids: one grid per antenna, resized to get_grid_size() and zero filled.
+     * @return false if an antenna has fewer data symbols than map.data_idx (nothing is mapped then).
+     */
+    inline bool map_to_grid(const grid_map_t & map, const MacPDU & pdu, array<vector<complex<float>>,2> & grids)
+    {
+        const size_t num_antennas = min<size_t>((pdu.mimo_.scheme==NONE) ? 1 : pdu.mimo_.num_tx_antenas, 2);
+        const size_t num_data = map.data_idx.size();
+        const size_t num_dci = map.dci_idx.size();
+        for (size_t ant=0; ant<num_antennas; ant++){
+            if (pdu.mimo_symbols_[ant].size() < num_data && pdu.symbols_.size() < num_data){return false;}
+        }
+        for (size_t ant=0; ant<num_antennas; ant++){
+            grids[ant].assign(get_grid_size(map.numID), complex<float>(0, 0));
+            const auto & data = pdu.mimo_symbols_[ant].size() >= num_data ? pdu.mimo_symbols_[ant] : pdu.symbols_;
+            const auto & control = pdu.control_symbols_[ant];
+            map_to_grid(map, data.data(), control.size() >= num_dci ? control.data() : nullptr, complex<float>(1, 0), grids[ant].data());
+        }
+        return true;
+    }
+
+    /**
+     * @brief Gathers the data REs of an allocation from a received grid (inverse of map_to_grid()).
+     * @param data: output, map.data_idx.size() symbols in mapping order.
+     */
+    inline void demap_from_grid(const grid_map_t & map, const complex<float> * grid, complex<float> * data)
+    {
+        complex<float> * dst = data;
+        for (const auto & run : map.data_runs){
+            memcpy(dst, grid + run.offset, run.length*sizeof(complex<float>));
+            dst += run.length;
+        }
+    }
+
+    /**
+     * @brief Gathers arbitrary REs (e.g. map.pilot_idx or map.dci_idx) from a received grid.
+     */
+    inline void gather_from_grid(const vector<uint32_t> & idx, const complex<float> * grid, complex<float> * out)
+    {
+        const size_t n = idx.size();
+        for (size_t i=0; i<n; i++){
+            if (i + GRID_PREFETCH_DISTANCE < n){
+                __builtin_prefetch(grid + idx[i+GRID_PREFETCH_DISTANCE], 0);
+            }
+            out[i] = grid[idx[i]];
+        }
+    }
+
+} /* namespace lib5grange */
+#endif /* INCLUDED_LIB5GRANGE_GRID_MAP_H */
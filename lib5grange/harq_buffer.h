@@ -0,0 +1,388 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_LIB5GRANGE_HARQ_BUFFER_H
+#define INCLUDED_LIB5GRANGE_HARQ_BUFFER_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "lib5grange.h"
+
+/** LLRs per pool block (soft buffers are chains of blocks) **/
+#define HARQ_BLOCK_LLRS (4096)
+
+/** Default number of HARQ processes tracked at the same time **/
+#define HARQ_MAX_PROCESSES (4096)
+
+/** Largest magnitude of a combined LLR (symmetric int8 range, as LLR_INT8_MAX) **/
+#define HARQ_LLR_MAX (127)
+
+namespace lib5grange {
+    using namespace std;
+
+    /** Result of HarqBufferPool::combine() **/
+    typedef enum {
+        HARQ_NEW_DATA,        /**< Buffer (re)started with the received LLRs **/
+        HARQ_COMBINED,        /**< Received LLRs added to the stored ones **/
+        HARQ_NO_MEMORY        /**< Not enough blocks even after evicting idle processes: nothing stored **/
+    } harq_status_t;
+
+    /** Usage counters of a HarqBufferPool **/
+    typedef struct {
+        size_t blocks_total;          /**< Blocks in the pool **/
+        size_t blocks_used;           /**< Blocks held by processes **/
+        size_t blocks_peak;           /**< Largest blocks_used seen **/
+        size_t processes;             /**< Active processes **/
+        uint64_t combines;            /**< Retransmissions combined **/
+        uint64_t evictions;           /**< Processes evicted to make room **/
+        uint64_t failures;            /**< combine() calls that returned HARQ_NO_MEMORY **/
+    } harq_stats_t;
+
+    /**
+     * @brief In-place saturating soft combining: acc = clamp(acc + llr, -HARQ_LLR_MAX, HARQ_LLR_MAX)
+     * @param acc: stored LLRs, updated in place.
+     * @param llr: received LLRs.
+     * @param n: number of LLRs.
+     * @param out: optional copy of the combined LLRs (nullptr for none).
+     */
+    inline void harq_combine_llr(int8_t * acc, const int8_t * llr, size_t n, int8_t * out = nullptr)
+    {
+        size_t i = 0;
+#if defined(__AVX2__)
+        const __m256i vmin = _mm256_set1_epi8(-HARQ_LLR_MAX);
+        for (; i+32<=n; i+=32){
+            __m256i a = _mm256_loadu_si256((const __m256i *)(acc+i));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(llr+i));
+            __m256i c = _mm256_max_epi8(_mm256_adds_epi8(a, b), vmin);
+            _mm256_storeu_si256((__m256i *)(acc+i), c);
+            if (out != nullptr){_mm256_storeu_si256((__m256i *)(out+i), c);}
+        }
+#elif defined(__SSE2__)
+        //No signed byte max in SSE2: saturate, then lift -128 to -127 with a compare
+        const __m128i vlow = _mm_set1_epi8(-128);
+        const __m128i vone = _mm_set1_epi8(1);
+        for (; i+16<=n; i+=16){
+            __m128i a = _mm_loadu_si128((const __m128i *)(acc+i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(llr+i));
+            __m128i c = _mm_adds_epi8(a, b);
+            c = _mm_add_epi8(c, _mm_and_si128(_mm_cmpeq_epi8(c, vlow), vone));
+            _mm_storeu_si128((__m128i *)(acc+i), c);
+            if (out != nullptr){_mm_storeu_si128((__m128i *)(out+i), c);}
+        }
+#endif
+        for (; i<n; i++){
+            int v = acc[i] + llr[i];
+            v = v > HARQ_LLR_MAX ? HARQ_LLR_MAX : (v < -HARQ_LLR_MAX ? -HARQ_LLR_MAX : v);
+            acc[i] = v;
+            if (out != nullptr){out[i] = v;}
+        }
+    }
+
+    /**
+     * @brief Pool of HARQ soft buffers (int8 LLRs) keyed by (UE, HARQ process / macphyctl_t::sequence_number).
+     *
+     * All memory is allocated once, from a byte budget: a soft buffer is a chain of HARQ_BLOCK_LLRS blocks
+     * taken from a free list, and process lookup is an open addressing table sized for max_processes, so
+     * nothing is allocated per transmission and the footprint stays fixed whatever the number of UEs.
+     * When the pool runs out of blocks, or a new process finds all max_processes entries taken, the least
+     * recently used processes are evicted (an intrusive LRU list through the entries, O(1) per eviction). Not thread safe: use
+     * one pool per receive thread (e.g. per cell).
+     */
+    class HarqBufferPool {
+        private:
+            typedef struct {
+                uint32_t key;             /**< (ue << 8) | process **/
+                bool used;
+                size_t num_llrs;          /**< LLRs stored **/
+                int32_t first_block;      /**< First block of the chain (-1: none) **/
+                uint32_t num_blocks;
+                int32_t lru_prev;         /**< Less recently used entry (-1: none) **/
+                int32_t lru_next;         /**< More recently used entry (-1: none) **/
+                uint8_t transmissions;    /**< Transmissions combined so far **/
+            } process_entry_t;
+
+            typedef struct {
+                uint32_t key;
+                int32_t entry;            /**< Index in entries_ (-1: empty slot) **/
+            } table_slot_t;
+
+            size_t block_llrs_;
+            int8_t * memory_ = nullptr;
+            vector<int32_t> next_block_;          /**< Chain links (-1: end) **/
+            vector<int32_t> free_blocks_;         /**< Free list (stack) **/
+            vector<process_entry_t> entries_;     /**< Process entries (fixed, max_processes) **/
+            vector<int32_t> free_entries_;        /**< Free entries (stack) **/
+            vector<table_slot_t> table_;          /**< Open addressing table (power of two size) **/
+            size_t table_mask_;
+            int32_t lru_head_ = -1;               /**< Least recently used entry **/
+            int32_t lru_tail_ = -1;               /**< Most recently used entry **/
+            harq_stats_t stats_ {};
+
+            static uint32_t make_key(uint16_t ue, uint8_t process){return (uint32_t(ue) << 8) | process;}
+
+            static size_t hash(uint32_t key){return (key * 2654435761u) >> 7;}
+
+            int8_t * block(int32_t b){return memory_ + size_t(b)*block_llrs_;}
+
+            /** Table slot of a key (or the empty slot ending its probe run) **/
+            size_t probe(uint32_t key){
+                size_t i = hash(key)&table_mask_;
+                while (table_[i].entry >= 0 && table_[i].key != key){i = (i+1)&table_mask_;}
+                return i;
+            }
+
+            process_entry_t * find(uint32_t key){
+                int32_t entry = table_[probe(key)].entry;
+                return entry < 0 ? nullptr : &entries_[entry];
+            }
+
+            void lru_unlink(int32_t i){
+                process_entry_t & e = entries_[i];
+                if (e.lru_prev >= 0){entries_[e.lru_prev].lru_next = e.lru_next;} else {lru_head_ = e.lru_next;}
+                if (e.lru_next >= 0){entries_[e.lru_next].lru_prev = e.lru_prev;} else {lru_tail_ = e.lru_prev;}
+                e.lru_prev = e.lru_next = -1;
+            }
+
+            /** Links an unlinked entry at the most recently used end **/
+            void lru_push(int32_t i){
+                entries_[i].lru_prev = lru_tail_;
+                if (lru_tail_ >= 0){entries_[lru_tail_].lru_next = i;} else {lru_head_ = i;}
+                lru_tail_ = i;
+            }
+
+            /** Moves an entry to the most recently used end **/
+            void lru_touch(process_entry_t * e){
+                int32_t i = e - entries_.data();
+                if (i == lru_tail_){return;}
+                lru_unlink(i);
+                lru_push(i);
+            }
+
+            /** Adds an entry, evicting the least recently used process if all entries are taken **/
+            process_entry_t * insert(uint32_t key){
+                if (free_entries_.empty()){
+                    if (lru_head_ < 0){return nullptr;}
+                    erase(&entries_[lru_head_]);
+                    stats_.evictions++;
+                }
+                int32_t i = free_entries_.back();
+                free_entries_.pop_back();
+                table_[probe(key)] = {key, i};
+                process_entry_t & e = entries_[i];
+                e = {key, true, 0, -1, 0, -1, -1, 0};
+                stats_.processes++;
+                lru_push(i);
+                return &e;
+            }
+
+            void free_chain(process_entry_t & e){
+                for (int32_t b=e.first_block; b>=0; ){
+                    int32_t next = next_block_[b];
+                    free_blocks_.push_back(b);
+                    b = next;
+                }
+                stats_.blocks_used -= e.num_blocks;
+                e.first_block = -1;
+                e.num_blocks = 0;
+                e.num_llrs = 0;
+            }
+
+            /** Removes an entry, shifting back the slots of its probe run (no tombstones) **/
+            void erase(process_entry_t * e){
+                free_chain(*e);
+                int32_t entry = e - entries_.data();
+                lru_unlink(entry);
+                e->used = false;
+                free_entries_.push_back(entry);
+                stats_.processes--;
+                size_t i = probe(e->key);
+                table_[i].entry = -1;
+                for (size_t j=(i+1)&table_mask_; table_[j].entry >= 0; j=(j+1)&table_mask_){
+                    size_t home = hash(table_[j].key)&table_mask_;
+                    //Move j into the hole if its home is not cyclically in (i, j]
+                    bool in_range = (i <= j) ? (home > i && home <= j) : (home > i || home <= j);
+                    if (!in_range){
+                        table_[i] = table_[j];
+                        table_[j].entry = -1;
+                        i = j;
+                    }
+                }
+            }
+
+            /** Evicts least recently used processes until enough blocks are free (except keep) **/
+            bool make_room(size_t blocks, uint32_t keep){
+                int32_t i = lru_head_;
+                while (free_blocks_.size() < blocks){
+                    //Only keep and processes without blocks are skipped, so this is O(1) per eviction
+                    while (i >= 0 && (entries_[i].key == keep || entries_[i].num_blocks == 0)){i = entries_[i].lru_next;}
+                    if (i < 0){return false;}
+                    int32_t next = entries_[i].lru_next;
+                    erase(&entries_[i]);
+                    stats_.evictions++;
+                    i = next;
+                }
+                return true;
+            }
+
+        public:
+            /**
+             * @brief Construct a new HarqBufferPool object
+             * @param memory_budget: bytes of LLR storage (rounded down to whole blocks).
+             * @param max_processes: largest number of processes tracked at the same time.
+             * @param block_llrs: LLRs per block (multiple of 64).
+             */
+            HarqBufferPool(size_t memory_budget, size_t max_processes = HARQ_MAX_PROCESSES, size_t block_llrs = HARQ_BLOCK_LLRS)
+            : block_llrs_(block_llrs)
+            {
+                size_t num_blocks = memory_budget / block_llrs_;
+                memory_ = (int8_t *) aligned_alloc(64, num_blocks*block_llrs_ + 64);
+                next_block_.assign(num_blocks, -1);
+                free_blocks_.reserve(num_blocks);
+                for (size_t b=num_blocks; b>0; b--){free_blocks_.push_back(b-1);}
+                entries_.assign(max_processes, process_entry_t{0, false, 0, -1, 0, -1, -1, 0});
+                free_entries_.reserve(max_processes);
+                for (size_t i=max_processes; i>0; i--){free_entries_.push_back(i-1);}
+                size_t table_size = 1;
+                while (table_size < 2*max_processes){table_size <<= 1;}
+                table_.assign(table_size, table_slot_t{0, -1});
+                table_mask_ = table_size-1;
+                stats_.blocks_total = num_blocks;
+            }
+
+            HarqBufferPool(const HarqBufferPool &) = delete;
+            HarqBufferPool & operator=(const HarqBufferPool &) = delete;
+
+            /** @brief Destroy the HarqBufferPool object **/
+            ~HarqBufferPool(){free(memory_);}
+
+            /**
+             * @brief Stores or combines the LLRs of a transmission
+             *
+             * A new transmission (or one whose size differs from the stored one) overwrites the buffer;
+             * a retransmission is added in place with saturation (see: harq_combine_llr()).
+             *
+             * @param ue: UE id (allocation_cfg_t::target_ue_id).
+             * @param process: HARQ process (macphyctl_t::sequence_number).
+             * @param llr: received int8 LLRs (see: soft_demap_maxlog()).
+             * @param n: number of LLRs.
+             * @param new_data: true for the first transmission of a transport block.
+             * @param combined: optional output of the combined LLRs, ready for decoding (nullptr for none).
+             * @return harq_status_t
+             */
+            harq_status_t combine(uint16_t ue, uint8_t process, const int8_t * llr, size_t n, bool new_data, int8_t * combined = nullptr)
+            {
+                const uint32_t key = make_key(ue, process);
+                process_entry_t * e = find(key);
+                if (e == nullptr){
+                    e = insert(key);
+                    if (e == nullptr){
+                        stats_.failures++;
+                        return HARQ_NO_MEMORY;
+                    }
+                    new_data = true;
+                }
+                lru_touch(e);
+                if (e->num_llrs != n){new_data = true;}
+
+                if (new_data){
+                    size_t needed = (n + block_llrs_ - 1)/block_llrs_;
+                    if (needed != e->num_blocks){
+                        free_chain(*e);
+                        if (!make_room(needed, key)){
+                            erase(e);
+                            stats_.failures++;
+                            return HARQ_NO_MEMORY;
+                        }
+                        int32_t * link = &e->first_block;
+                        for (size_t i=0; i<needed; i++){
+                            int32_t b = free_blocks_.back();
+                            free_blocks_.pop_back();
+                            *link = b;
+                            link = &next_block_[b];
+                        }
+                        *link = -1;
+                        e->num_blocks = needed;
+                        stats_.blocks_used += needed;
+                        if (stats_.blocks_used > stats_.blocks_peak){stats_.blocks_peak = stats_.blocks_used;}
+                    }
+                    e->num_llrs = n;
+                    e->transmissions = 1;
+                    size_t offset = 0;
+                    for (int32_t b=e->first_block; b>=0; b=next_block_[b]){
+                        size_t len = min(block_llrs_, n-offset);
+                        memcpy(block(b), llr+offset, len);
+                        if (combined != nullptr){memcpy(combined+offset, llr+offset, len);}
+                        offset += len;
+                    }
+                    return HARQ_NEW_DATA;
+                }
+
+                size_t offset = 0;
+                for (int32_t b=e->first_block; b>=0; b=next_block_[b]){
+                    size_t len = min(block_llrs_, n-offset);
+                    harq_combine_llr(block(b), llr+offset, len, combined != nullptr ? combined+offset : nullptr);
+                    offset += len;
+                }
+                if (e->transmissions < 255){e->transmissions++;}
+                stats_.combines++;
+                return HARQ_COMBINED;
+            }
+
+            /**
+             * @brief Copies the stored LLRs of a process
+             * @return number of LLRs copied (0 if the process holds no buffer)
+             */
+            size_t read(uint16_t ue, uint8_t process, int8_t * out)
+            {
+                process_entry_t * e = find(make_key(ue, process));
+                if (e == nullptr){return 0;}
+                size_t offset = 0;
+                for (int32_t b=e->first_block; b>=0; b=next_block_[b]){
+                    size_t len = min(block_llrs_, e->num_llrs-offset);
+                    memcpy(out+offset, block(b), len);
+                    offset += len;
+                }
+                return e->num_llrs;
+            }
+
+            /** @brief Number of transmissions combined in a process (0 if it holds no buffer) **/
+            unsigned transmissions(uint16_t ue, uint8_t process)
+            {
+                process_entry_t * e = find(make_key(ue, process));
+                return e == nullptr ? 0 : e->transmissions;
+            }
+
+            /** @brief Transport block decoded (ACK): the blocks of the process go back to the pool **/
+            void ack(uint16_t ue, uint8_t process)
+            {
+                process_entry_t * e = find(make_key(ue, process));
+                if (e != nullptr){erase(e);}
+            }
+
+            /** @brief Releases every process of a UE (e.g. on detach) **/
+            void release_ue(uint16_t ue)
+            {
+                vector<uint8_t> processes;
+                for (auto & e : entries_){
+                    if (e.used && (e.key >> 8) == ue){processes.push_back(e.key & 0xFF);}
+                }
+                for (uint8_t p : processes){ack(ue, p);}
+            }
+
+            /** @brief Usage counters **/
+            const harq_stats_t & stats() const {return stats_;}
+
+            /** @brief Bytes of LLR storage of the pool **/
+            size_t capacity_bytes() const {return stats_.blocks_total*block_llrs_;}
+    }; /* class HarqBufferPool */
+
+} /* namespace lib5grange */
+#endif /* INCLUDED_LIB5GRANGE_HARQ_BUFFER_H */
@@ -706,6 +706,32 @@ namespace lib5grange {
         return (get_bit_capacity(numID, allocation, mimo, mod)/8 * coderate);
     }
 
+    /**
+     * @brief Number of time domain samples in a subframe
+     * 
+     * A subframe is made of symbols_per_subframe blocks of k*m samples, each one extended by
+     * ncp samples of cyclic prefix and ncs samples of cyclic suffix.
+     * 
+     * @param numID: (0 - 5) Number identifying the 5G Range numerology according to D3.2.
+     * @return size_t 
+     */
+    inline size_t
+    get_subframe_samples(const size_t & numID)
+    {
+        const auto & num = numerology[numID];
+        return num.symbols_per_subframe * (num.k*num.m + num.ncp + num.ncs);
+    }
+
+    /**
+     * @brief Subframe duration in seconds at SAMPLE_RATE
+     * @param numID: (0 - 5) Number identifying the 5G Range numerology according to D3.2.
+     */
+    inline double
+    get_subframe_duration(const size_t & numID)
+    {
+        return double(get_subframe_samples(numID)) / double(SAMPLE_RATE);
+    }
+
 
 } /* namespace lib5grange */
 #endif /* INCLUDED_LIB5GRANGE_H */
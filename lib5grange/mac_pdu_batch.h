@@ -0,0 +1,359 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_LIB5GRANGE_MAC_PDU_BATCH_H
+#define INCLUDED_LIB5GRANGE_MAC_PDU_BATCH_H
+
+#include <cstdint>
+#include <cassert>
+#include <complex>
+#include <vector>
+#include <array>
+#include <type_traits>
+#include "lib5grange.h"
+
+/** macphyctl_t::last_tb_in_subframe flag bit **/
+#define MAC_PDU_FLAG_LAST_TB  (0x01)
+/** macphyctl_t::first_tb_in_subframe flag bit **/
+#define MAC_PDU_FLAG_FIRST_TB (0x02)
+
+namespace lib5grange {
+    using namespace std;
+
+    /**
+     * @brief Compact, trivially copyable copy of the configuration of a MacPDU (the hot part).
+     *
+     * Every field that fits in a byte is stored as a byte; the wire format is untouched, since
+     * conversion back to the config structs happens before serialization. This is the per-PDU view of
+     * one row of mac_pdu_headers_t.
+     */
+    struct MacPDUHeader {
+        uint32_t subframe_number;   /**< macphyctl_t::subframe_number **/
+        uint32_t num_info_bytes;    /**< mcs_cfg_t::num_info_bytes **/
+        uint32_t num_coded_bytes;   /**< mcs_cfg_t::num_coded_bytes **/
+        float snr_avg;              /**< Average SNR measured **/
+        uint8_t numID;              /**< Numerology ID **/
+        uint8_t sequence_number;    /**< macphyctl_t::sequence_number **/
+        uint8_t flags;              /**< MAC_PDU_FLAG_* bits **/
+        uint8_t target_ue_id;       /**< allocation_cfg_t::target_ue_id **/
+        uint8_t first_rb;           /**< allocation_cfg_t::first_rb **/
+        uint8_t number_of_rb;       /**< allocation_cfg_t::number_of_rb **/
+        uint8_t mimo_scheme;        /**< mimo_cfg_t::scheme **/
+        uint8_t num_tx_antenas;     /**< mimo_cfg_t::num_tx_antenas **/
+        uint8_t precoding_mtx;      /**< mimo_cfg_t::precoding_mtx **/
+        uint8_t modulation;         /**< mcs_cfg_t::modulation **/
+        uint8_t power_offset;       /**< mcs_cfg_t::power_offset **/
+        uint8_t rankIndicator;      /**< Rank indicator **/
+
+        /**
+         * @brief Builds the header from the config members of a MacPDU
+         *
+         * The size_t/unsigned config fields are narrowed to the header widths; values that do not fit
+         * are a caller error (asserted), since a truncated byte count or antenna number would be
+         * silently wrong.
+         **/
+        static MacPDUHeader from(const MacPDU & pdu){
+            assert(pdu.mcs_.num_info_bytes <= UINT32_MAX);
+            assert(pdu.mcs_.num_coded_bytes <= UINT32_MAX);
+            assert(pdu.numID_ <= UINT8_MAX);
+            assert(pdu.mimo_.num_tx_antenas <= UINT8_MAX);
+            assert(pdu.mimo_.precoding_mtx <= UINT8_MAX);
+            assert(pdu.mcs_.power_offset <= UINT8_MAX);
+            MacPDUHeader h;
+            h.subframe_number = pdu.macphy_ctl_.subframe_number;
+            h.num_info_bytes  = pdu.mcs_.num_info_bytes;
+            h.num_coded_bytes = pdu.mcs_.num_coded_bytes;
+            h.snr_avg         = pdu.snr_avg_;
+            h.numID           = pdu.numID_;
+            h.sequence_number = pdu.macphy_ctl_.sequence_number;
+            h.flags           = (pdu.macphy_ctl_.last_tb_in_subframe ? MAC_PDU_FLAG_LAST_TB : 0) |
+                                (pdu.macphy_ctl_.first_tb_in_subframe ? MAC_PDU_FLAG_FIRST_TB : 0);
+            h.target_ue_id    = pdu.allocation_.target_ue_id;
+            h.first_rb        = pdu.allocation_.first_rb;
+            h.number_of_rb    = pdu.allocation_.number_of_rb;
+            h.mimo_scheme     = pdu.mimo_.scheme;
+            h.num_tx_antenas  = pdu.mimo_.num_tx_antenas;
+            h.precoding_mtx   = pdu.mimo_.precoding_mtx;
+            h.modulation      = pdu.mcs_.modulation;
+            h.power_offset    = pdu.mcs_.power_offset;
+            h.rankIndicator   = pdu.rankIndicator_;
+            return h;
+        }
+
+        /** @brief MAC/PHY control struct **/
+        macphyctl_t macphy_ctl() const {
+            macphyctl_t ctl;
+            ctl.sequence_number = sequence_number;
+            ctl.subframe_number = subframe_number;
+            ctl.last_tb_in_subframe = (flags & MAC_PDU_FLAG_LAST_TB) != 0;
+            ctl.first_tb_in_subframe = (flags & MAC_PDU_FLAG_FIRST_TB) != 0;
+            return ctl;
+        }
+
+        /** @brief Resource allocation struct **/
+        allocation_cfg_t allocation() const {
+            allocation_cfg_t aloc;
+            aloc.target_ue_id = target_ue_id;
+            aloc.first_rb = first_rb;
+            aloc.number_of_rb = number_of_rb;
+            return aloc;
+        }
+
+        /** @brief MIMO config struct **/
+        mimo_cfg_t mimo() const {
+            mimo_cfg_t cfg;
+            cfg.scheme = (mimo_scheme_t) mimo_scheme;
+            cfg.num_tx_antenas = num_tx_antenas;
+            cfg.precoding_mtx = precoding_mtx;
+            return cfg;
+        }
+
+        /** @brief Modulation and coding config struct **/
+        mcs_cfg_t mcs() const {
+            mcs_cfg_t cfg;
+            cfg.modulation = (qammod_t) modulation;
+            cfg.power_offset = power_offset;
+            cfg.num_info_bytes = num_info_bytes;
+            cfg.num_coded_bytes = num_coded_bytes;
+            return cfg;
+        }
+
+        /** @brief Copies the header into the config members of a MacPDU **/
+        void to(MacPDU & pdu) const {
+            pdu.numID_ = numID;
+            pdu.macphy_ctl_ = macphy_ctl();
+            pdu.allocation_ = allocation();
+            pdu.mimo_ = mimo();
+            pdu.mcs_ = mcs();
+            pdu.snr_avg_ = snr_avg;
+            pdu.rankIndicator_ = rankIndicator;
+        }
+    }; /* struct MacPDUHeader */
+
+    static_assert(sizeof(MacPDUHeader) <= 32, "MacPDUHeader must fit in half a cache line");
+    static_assert(is_trivially_copyable<MacPDUHeader>::value, "MacPDUHeader must be trivially copyable");
+
+    /**
+     * @brief Headers of a batch of PDUs, one array per MacPDUHeader field (SoA).
+     *
+     * A loop over one field (e.g. number_of_rb of every PDU) reads a contiguous array of that field only,
+     * 1 or 4 bytes per PDU, instead of striding over whole headers.
+     */
+    typedef struct {
+        vector<uint32_t> subframe_number;
+        vector<uint32_t> num_info_bytes;
+        vector<uint32_t> num_coded_bytes;
+        vector<float> snr_avg;
+        vector<uint8_t> numID;
+        vector<uint8_t> sequence_number;
+        vector<uint8_t> flags;
+        vector<uint8_t> target_ue_id;
+        vector<uint8_t> first_rb;
+        vector<uint8_t> number_of_rb;
+        vector<uint8_t> mimo_scheme;
+        vector<uint8_t> num_tx_antenas;
+        vector<uint8_t> precoding_mtx;
+        vector<uint8_t> modulation;
+        vector<uint8_t> power_offset;
+        vector<uint8_t> rankIndicator;
+
+        /** @brief Number of headers **/
+        size_t size() const {return subframe_number.size();}
+
+        /** @brief Applies fn(member vector) to every field array **/
+        template <typename F>
+        void for_each_field(F fn){
+            fn(subframe_number); fn(num_info_bytes); fn(num_coded_bytes); fn(snr_avg);
+            fn(numID); fn(sequence_number); fn(flags); fn(target_ue_id);
+            fn(first_rb); fn(number_of_rb); fn(mimo_scheme); fn(num_tx_antenas);
+            fn(precoding_mtx); fn(modulation); fn(power_offset); fn(rankIndicator);
+        }
+
+        /** @brief Reserves space for n headers **/
+        void reserve(size_t n){for_each_field([n](auto & v){v.reserve(n);});}
+
+        /** @brief Removes all headers **/
+        void clear(){for_each_field([](auto & v){v.clear();});}
+
+        /** @brief Appends a header **/
+        void push_back(const MacPDUHeader & h){
+            for_each_field([](auto & v){v.emplace_back();});
+            set(size() - 1, h);
+        }
+
+        /** @brief Gathers header i **/
+        MacPDUHeader get(size_t i) const {
+            MacPDUHeader h;
+            h.subframe_number = subframe_number[i];
+            h.num_info_bytes  = num_info_bytes[i];
+            h.num_coded_bytes = num_coded_bytes[i];
+            h.snr_avg         = snr_avg[i];
+            h.numID           = numID[i];
+            h.sequence_number = sequence_number[i];
+            h.flags           = flags[i];
+            h.target_ue_id    = target_ue_id[i];
+            h.first_rb        = first_rb[i];
+            h.number_of_rb    = number_of_rb[i];
+            h.mimo_scheme     = mimo_scheme[i];
+            h.num_tx_antenas  = num_tx_antenas[i];
+            h.precoding_mtx   = precoding_mtx[i];
+            h.modulation      = modulation[i];
+            h.power_offset    = power_offset[i];
+            h.rankIndicator   = rankIndicator[i];
+            return h;
+        }
+
+        /** @brief Scatters a header into row i **/
+        void set(size_t i, const MacPDUHeader & h){
+            subframe_number[i] = h.subframe_number;
+            num_info_bytes[i]  = h.num_info_bytes;
+            num_coded_bytes[i] = h.num_coded_bytes;
+            snr_avg[i]         = h.snr_avg;
+            numID[i]           = h.numID;
+            sequence_number[i] = h.sequence_number;
+            flags[i]           = h.flags;
+            target_ue_id[i]    = h.target_ue_id;
+            first_rb[i]        = h.first_rb;
+            number_of_rb[i]    = h.number_of_rb;
+            mimo_scheme[i]     = h.mimo_scheme;
+            num_tx_antenas[i]  = h.num_tx_antenas;
+            precoding_mtx[i]   = h.precoding_mtx;
+            modulation[i]      = h.modulation;
+            power_offset[i]    = h.power_offset;
+            rankIndicator[i]   = h.rankIndicator;
+        }
+    } mac_pdu_headers_t;
+
+    /** @brief Data section of a MacPDU (the cold part) **/
+    typedef struct {
+        vector<uint8_t> mac_data_ {};                                       /**< Uncoded information bits from MAC. **/
+        vector<uint8_t> coded_data_ {};                                     /**< Coded bits to be transmitted. **/
+        vector<complex<float>> symbols_ {};                                 /**< QAM symbols to be transmitted  **/
+        array<vector<complex<float>>,2> mimo_symbols_ {};                   /**< MIMO encoded information symbols**/
+        vector<uint8_t> control_data_ {};                                   /**< Coded control information bits to be transmitted **/
+        array<vector<complex<float>>,2> control_symbols_ {};                /**< Control QAM symbols to be transmitted **/
+    } MacPDUPayload;
+
+    /**
+     * @brief Container of the PDUs of a subframe with headers and payloads kept in separate arrays.
+     *
+     * Headers are stored field by field (see: mac_pdu_headers_t), so loops over configurations only touch
+     * the arrays of the fields they use; header(i) gathers a whole header when one PDU is handled at a time.
+     */
+    class MacPDUBatch {
+        private:
+            mac_pdu_headers_t headers_;
+            vector<MacPDUPayload> payloads_;
+
+        public:
+            /** @brief Number of PDUs in the batch **/
+            size_t size() const {return headers_.size();}
+
+            /** @brief Reserves space for n PDUs **/
+            void reserve(size_t n){
+                headers_.reserve(n);
+                payloads_.reserve(n);
+            }
+
+            /** @brief Removes all PDUs (the payload buffers are released) **/
+            void clear(){
+                headers_.clear();
+                payloads_.clear();
+            }
+
+            /** @brief Header field arrays **/
+            mac_pdu_headers_t & headers(){return headers_;}
+            const mac_pdu_headers_t & headers() const {return headers_;}
+
+            /** @brief Header of PDU i (gathered copy) **/
+            MacPDUHeader header(size_t i) const {return headers_.get(i);}
+
+            /** @brief Replaces the header of PDU i **/
+            void set_header(size_t i, const MacPDUHeader & header){headers_.set(i, header);}
+
+            /** @brief Payload of PDU i **/
+            MacPDUPayload & payload(size_t i){return payloads_[i];}
+            const MacPDUPayload & payload(size_t i) const {return payloads_[i];}
+
+            /** @brief Appends a PDU with an empty payload and returns its index **/
+            size_t push_back(const MacPDUHeader & header){
+                headers_.push_back(header);
+                payloads_.emplace_back();
+                return headers_.size() - 1;
+            }
+
+            /** @brief Appends a MacPDU, moving its data vectors into the batch **/
+            size_t push_back(MacPDU && pdu){
+                size_t i = push_back(MacPDUHeader::from(pdu));
+                MacPDUPayload & p = payloads_[i];
+                p.mac_data_ = move(pdu.mac_data_);
+                p.coded_data_ = move(pdu.coded_data_);
+                p.symbols_ = move(pdu.symbols_);
+                p.mimo_symbols_ = move(pdu.mimo_symbols_);
+                p.control_data_ = move(pdu.control_data_);
+                p.control_symbols_ = move(pdu.control_symbols_);
+                return i;
+            }
+
+            /** @brief Appends a copy of a MacPDU **/
+            size_t push_back(const MacPDU & pdu){
+                MacPDU copy = pdu;
+                return push_back(move(copy));
+            }
+
+            /**
+             * @brief Moves PDU i out of the batch as a MacPDU object (its payload is left empty)
+             * @param i: index of the PDU.
+             * @param pdu: MacPDU object where header and payload are stored.
+             */
+            void extract(size_t i, MacPDU & pdu){
+                headers_.get(i).to(pdu);
+                MacPDUPayload & p = payloads_[i];
+                pdu.mac_data_ = move(p.mac_data_);
+                pdu.coded_data_ = move(p.coded_data_);
+                pdu.symbols_ = move(p.symbols_);
+                pdu.mimo_symbols_ = move(p.mimo_symbols_);
+                pdu.control_data_ = move(p.control_data_);
+                pdu.control_symbols_ = move(p.control_symbols_);
+            }
+
+            /**
+             * @brief Serializes PDU i with the same byte layout as MacPDU::serialize()
+             * @param i: index of the PDU.
+             * @param bytes: vector where the bytes will be appended.
+             */
+            void serialize(size_t i, vector<uint8_t> & bytes){
+                const MacPDUHeader h = headers_.get(i);
+                unsigned numID = h.numID;
+                macphyctl_t ctl = h.macphy_ctl();
+                allocation_cfg_t aloc = h.allocation();
+                mimo_cfg_t mimo = h.mimo();
+                mcs_cfg_t mcs = h.mcs();
+                push_bytes(bytes, numID);
+                ctl.serialize(bytes);
+                aloc.serialize(bytes);
+                mimo.serialize(bytes);
+                mcs.serialize(bytes);
+                push_bytes(bytes, h.snr_avg);
+                push_bytes(bytes, h.rankIndicator);
+                serialize_vector(bytes, payloads_[i].mac_data_);
+            }
+    }; /* class MacPDUBatch */
+
+    /** @brief Get the RE capacity from a PDU header **/
+    inline size_t get_re_capacity(const MacPDUHeader & h)
+    {
+        return get_re_capacity(h.numID, h.allocation(), h.mimo());
+    }
+
+    /** @brief Get the gross bit capacity from a PDU header **/
+    inline size_t get_bit_capacity(const MacPDUHeader & h)
+    {
+        return get_bit_capacity(h.numID, h.allocation(), h.mimo(), (qammod_t) h.modulation);
+    }
+
+} /* namespace lib5grange */
+#endif /* INCLUDED_LIB5GRANGE_MAC_PDU_BATCH_H */
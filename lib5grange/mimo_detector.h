@@ -0,0 +1,460 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_LIB5GRANGE_MIMO_DETECTOR_H
+#define INCLUDED_LIB5GRANGE_MIMO_DETECTOR_H
+
+#include <cstdint>
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "lib5grange.h"
+#include "grid_map.h"
+
+/** Lower bound of the MMSE denominators (rank deficient channels) **/
+#define MIMO_MIN_DET (1e-20f)
+
+/** Lower bound of the noise variance **/
+#define MIMO_MIN_NOISE_VAR (1e-12f)
+
+namespace lib5grange {
+    using namespace std;
+
+    /**
+     * @brief 2x2 channel in SoA layout.
+     *
+     * re[r][t][i] / im[r][t][i] is the channel from transmit antenna t to receive antenna r on RE i
+     * (e.g. channel_estimate_t::h_re/h_im gathered for each antenna pair). The estimates are the effective
+     * channels of unit energy symbols, i.e. any transmit power split is included.
+     */
+    typedef struct {
+        const float * re[2][2];
+        const float * im[2][2];
+    } mimo_channel_t;
+
+    /**
+     * @brief Received symbols of two antennas (inputs) or detected symbols of two streams (outputs) in SoA layout.
+     */
+    typedef struct {
+        float * re[2];
+        float * im[2];
+    } mimo_streams_t;
+
+    /**
+     * @brief Closed-form unbiased 2x2 MMSE filter of one channel.
+     *
+     * With G = H^H H + N0 I = [a b; b* d] and z = H^H y, the MMSE estimates are (d z1 - b z2)/det and
+     * (a z2 - b* z1)/det. Removing the MMSE bias divides stream 1 by (det - N0 d)/det (stream 2 by
+     * (det - N0 a)/det), and the post-equalization SINRs are (det - N0 d)/(N0 d) and (det - N0 a)/(N0 a).
+     * @param h: channel h[r][t].
+     * @param n0: noise variance.
+     * @param w: output, filter w[s][r] (x_s = sum_r w[s][r] y_r).
+     * @param sinr: output, linear post-equalization SINR of each stream.
+     */
+    inline void mmse_2x2_filter(const complex<float> h[2][2], float n0, complex<float> w[2][2], float sinr[2])
+    {
+        const float a = norm(h[0][0]) + norm(h[1][0]) + n0;
+        const float d = norm(h[0][1]) + norm(h[1][1]) + n0;
+        const complex<float> b = conj(h[0][0])*h[0][1] + conj(h[1][0])*h[1][1];
+        const float bb = norm(b);
+        const float u1 = max(d*(a-n0) - bb, MIMO_MIN_DET);
+        const float u2 = max(a*(d-n0) - bb, MIMO_MIN_DET);
+        for (int r=0; r<2; r++){
+            w[0][r] = (d*conj(h[r][0]) - b*conj(h[r][1])) / u1;
+            w[1][r] = (a*conj(h[r][1]) - conj(b)*conj(h[r][0])) / u2;
+        }
+        sinr[0] = u1 / (n0*d);
+        sinr[1] = u2 / (n0*a);
+    }
+
+    /**
+     * @brief Scalar unbiased 2x2 MMSE kernel on REs [first, n) (see: mmse_2x2_filter()).
+     * Written on real parts so the compiler can vectorize it.
+     */
+    inline void mmse_2x2_scalar(const mimo_channel_t & h, const mimo_streams_t & y, size_t first, size_t n, float n0,
+                                const mimo_streams_t & x, float * const sinr[2])
+    {
+        for (size_t i=first; i<n; i++){
+            const float h11r = h.re[0][0][i], h11i = h.im[0][0][i], h12r = h.re[0][1][i], h12i = h.im[0][1][i];
+            const float h21r = h.re[1][0][i], h21i = h.im[1][0][i], h22r = h.re[1][1][i], h22i = h.im[1][1][i];
+            const float y1r = y.re[0][i], y1i = y.im[0][i], y2r = y.re[1][i], y2i = y.im[1][i];
+            const float a = h11r*h11r + h11i*h11i + h21r*h21r + h21i*h21i + n0;
+            const float d = h12r*h12r + h12i*h12i + h22r*h22r + h22i*h22i + n0;
+            const float br = h11r*h12r + h11i*h12i + h21r*h22r + h21i*h22i;
+            const float bi = h11r*h12i - h11i*h12r + h21r*h22i - h21i*h22r;
+            const float z1r = h11r*y1r + h11i*y1i + h21r*y2r + h21i*y2i;
+            const float z1i = h11r*y1i - h11i*y1r + h21r*y2i - h21i*y2r;
+            const float z2r = h12r*y1r + h12i*y1i + h22r*y2r + h22i*y2i;
+            const float z2i = h12r*y1i - h12i*y1r + h22r*y2i - h22i*y2r;
+            const float bb = br*br + bi*bi;
+            const float u1 = max(d*(a-n0) - bb, MIMO_MIN_DET);
+            const float u2 = max(a*(d-n0) - bb, MIMO_MIN_DET);
+            const float inv1 = 1.0f/u1, inv2 = 1.0f/u2;
+            x.re[0][i] = (d*z1r - (br*z2r - bi*z2i)) * inv1;
+            x.im[0][i] = (d*z1i - (br*z2i + bi*z2r)) * inv1;
+            x.re[1][i] = (a*z2r - (br*z1r + bi*z1i)) * inv2;
+            x.im[1][i] = (a*z2i - (br*z1i - bi*z1r)) * inv2;
+            sinr[0][i] = u1 / (n0*d);
+            sinr[1][i] = u2 / (n0*a);
+        }
+    }
+
+#if defined(__AVX2__)
+    /** @brief (ar + j ai)^* (br + j bi), real part **/
+    inline __m256 cmulc_re_avx2(__m256 ar, __m256 ai, __m256 br, __m256 bi)
+    {
+        return _mm256_add_ps(_mm256_mul_ps(ar, br), _mm256_mul_ps(ai, bi));
+    }
+
+    /** @brief (ar + j ai)^* (br + j bi), imaginary part **/
+    inline __m256 cmulc_im_avx2(__m256 ar, __m256 ai, __m256 br, __m256 bi)
+    {
+        return _mm256_sub_ps(_mm256_mul_ps(ar, bi), _mm256_mul_ps(ai, br));
+    }
+
+    /**
+     * @brief AVX2 unbiased 2x2 MMSE kernel (8 REs per iteration, see: mmse_2x2_filter()).
+     * @return Number of REs processed; the tail is left to the scalar kernel.
+     */
+    inline size_t mmse_2x2_avx2(const mimo_channel_t & h, const mimo_streams_t & y, size_t n, float n0,
+                                const mimo_streams_t & x, float * const sinr[2])
+    {
+        const __m256 vn0 = _mm256_set1_ps(n0);
+        const __m256 vmin = _mm256_set1_ps(MIMO_MIN_DET);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        size_t i = 0;
+        for (; i+8<=n; i+=8){
+            __m256 h11r = _mm256_loadu_ps(h.re[0][0]+i), h11i = _mm256_loadu_ps(h.im[0][0]+i);
+            __m256 h12r = _mm256_loadu_ps(h.re[0][1]+i), h12i = _mm256_loadu_ps(h.im[0][1]+i);
+            __m256 h21r = _mm256_loadu_ps(h.re[1][0]+i), h21i = _mm256_loadu_ps(h.im[1][0]+i);
+            __m256 h22r = _mm256_loadu_ps(h.re[1][1]+i), h22i = _mm256_loadu_ps(h.im[1][1]+i);
+            __m256 y1r = _mm256_loadu_ps(y.re[0]+i), y1i = _mm256_loadu_ps(y.im[0]+i);
+            __m256 y2r = _mm256_loadu_ps(y.re[1]+i), y2i = _mm256_loadu_ps(y.im[1]+i);
+
+            __m256 a = _mm256_add_ps(_mm256_add_ps(cmulc_re_avx2(h11r, h11i, h11r, h11i), cmulc_re_avx2(h21r, h21i, h21r, h21i)), vn0);
+            __m256 d = _mm256_add_ps(_mm256_add_ps(cmulc_re_avx2(h12r, h12i, h12r, h12i), cmulc_re_avx2(h22r, h22i, h22r, h22i)), vn0);
+            __m256 br = _mm256_add_ps(cmulc_re_avx2(h11r, h11i, h12r, h12i), cmulc_re_avx2(h21r, h21i, h22r, h22i));
+            __m256 bi = _mm256_add_ps(cmulc_im_avx2(h11r, h11i, h12r, h12i), cmulc_im_avx2(h21r, h21i, h22r, h22i));
+            __m256 z1r = _mm256_add_ps(cmulc_re_avx2(h11r, h11i, y1r, y1i), cmulc_re_avx2(h21r, h21i, y2r, y2i));
+            __m256 z1i = _mm256_add_ps(cmulc_im_avx2(h11r, h11i, y1r, y1i), cmulc_im_avx2(h21r, h21i, y2r, y2i));
+            __m256 z2r = _mm256_add_ps(cmulc_re_avx2(h12r, h12i, y1r, y1i), cmulc_re_avx2(h22r, h22i, y2r, y2i));
+            __m256 z2i = _mm256_add_ps(cmulc_im_avx2(h12r, h12i, y1r, y1i), cmulc_im_avx2(h22r, h22i, y2r, y2i));
+
+            __m256 bb = _mm256_add_ps(_mm256_mul_ps(br, br), _mm256_mul_ps(bi, bi));
+            __m256 u1 = _mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(d, _mm256_sub_ps(a, vn0)), bb), vmin);
+            __m256 u2 = _mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(a, _mm256_sub_ps(d, vn0)), bb), vmin);
+            __m256 inv1 = _mm256_div_ps(one, u1);
+            __m256 inv2 = _mm256_div_ps(one, u2);
+
+            // x1 = (d z1 - b z2)/u1, x2 = (a z2 - b* z1)/u2
+            __m256 x1r = _mm256_sub_ps(_mm256_mul_ps(d, z1r), _mm256_sub_ps(_mm256_mul_ps(br, z2r), _mm256_mul_ps(bi, z2i)));
+            __m256 x1i = _mm256_sub_ps(_mm256_mul_ps(d, z1i), _mm256_add_ps(_mm256_mul_ps(br, z2i), _mm256_mul_ps(bi, z2r)));
+            __m256 x2r = _mm256_sub_ps(_mm256_mul_ps(a, z2r), cmulc_re_avx2(br, bi, z1r, z1i));
+            __m256 x2i = _mm256_sub_ps(_mm256_mul_ps(a, z2i), cmulc_im_avx2(br, bi, z1r, z1i));
+            _mm256_storeu_ps(x.re[0]+i, _mm256_mul_ps(x1r, inv1));
+            _mm256_storeu_ps(x.im[0]+i, _mm256_mul_ps(x1i, inv1));
+            _mm256_storeu_ps(x.re[1]+i, _mm256_mul_ps(x2r, inv2));
+            _mm256_storeu_ps(x.im[1]+i, _mm256_mul_ps(x2i, inv2));
+            _mm256_storeu_ps(sinr[0]+i, _mm256_div_ps(u1, _mm256_mul_ps(vn0, d)));
+            _mm256_storeu_ps(sinr[1]+i, _mm256_div_ps(u2, _mm256_mul_ps(vn0, a)));
+        }
+        return i;
+    }
+#endif
+
+    /**
+     * @brief Batched 2x2 MMSE detector with one channel per RE (spatial multiplexing, rank 2).
+     *
+     * The detected symbols are unbiased, so they can be fed to the soft demapper with noise variance
+     * 1/sinr (see: sinr_to_noise_var()).
+     * @param h: channel of each RE.
+     * @param y: received symbols of each antenna.
+     * @param n: number of REs.
+     * @param noise_var: noise variance N0 (e.g. channel_estimate_t::noise_var_avg).
+     * @param x: output, n detected symbols per stream.
+     * @param sinr: output, n linear post-equalization SINRs per stream.
+     */
+    inline void mmse_2x2_detect(const mimo_channel_t & h, const mimo_streams_t & y, size_t n, float noise_var,
+                                const mimo_streams_t & x, float * const sinr[2])
+    {
+        const float n0 = max(noise_var, MIMO_MIN_NOISE_VAR);
+        size_t i = 0;
+#if defined(__AVX2__)
+        i = mmse_2x2_avx2(h, y, n, n0, x, sinr);
+#endif
+        mmse_2x2_scalar(h, y, i, n, n0, x, sinr);
+    }
+
+    /**
+     * @brief Applies a 2x2 filter to REs [first, first+len): x[s] = w[s][0] y[0] + w[s][1] y[1].
+     */
+    inline void mmse_2x2_apply(const complex<float> w[2][2], const mimo_streams_t & y, size_t first, size_t len,
+                               const mimo_streams_t & x)
+    {
+        for (int s=0; s<2; s++){
+            const float w1r = w[s][0].real(), w1i = w[s][0].imag();
+            const float w2r = w[s][1].real(), w2i = w[s][1].imag();
+            const float * y1r = y.re[0]+first;
+            const float * y1i = y.im[0]+first;
+            const float * y2r = y.re[1]+first;
+            const float * y2i = y.im[1]+first;
+            float * xr = x.re[s]+first;
+            float * xi = x.im[s]+first;
+            size_t i = 0;
+#if defined(__AVX2__)
+            const __m256 vw1r = _mm256_set1_ps(w1r), vw1i = _mm256_set1_ps(w1i);
+            const __m256 vw2r = _mm256_set1_ps(w2r), vw2i = _mm256_set1_ps(w2i);
+            for (; i+8<=len; i+=8){
+                __m256 a_r = _mm256_loadu_ps(y1r+i), a_i = _mm256_loadu_ps(y1i+i);
+                __m256 b_r = _mm256_loadu_ps(y2r+i), b_i = _mm256_loadu_ps(y2i+i);
+                __m256 re = _mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(vw1r, a_r), _mm256_mul_ps(vw2r, b_r)),
+                                          _mm256_add_ps(_mm256_mul_ps(vw1i, a_i), _mm256_mul_ps(vw2i, b_i)));
+                __m256 im = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vw1r, a_i), _mm256_mul_ps(vw2r, b_i)),
+                                          _mm256_add_ps(_mm256_mul_ps(vw1i, a_r), _mm256_mul_ps(vw2i, b_r)));
+                _mm256_storeu_ps(xr+i, re);
+                _mm256_storeu_ps(xi+i, im);
+            }
+#endif
+            for (; i<len; i++){
+                xr[i] = w1r*y1r[i] - w1i*y1i[i] + w2r*y2r[i] - w2i*y2i[i];
+                xi[i] = w1r*y1i[i] + w1i*y1r[i] + w2r*y2i[i] + w2i*y2r[i];
+            }
+        }
+    }
+
+    /**
+     * @brief Batched 2x2 MMSE detector with one channel per RB.
+     *
+     * The unbiased MMSE filter W of each RB is computed once and applied to all its REs, so the SINR is
+     * per RB as well and maps directly onto the per RB noise variance of the soft demapper. REs are in
+     * data_idx order and the RB of each one comes from the RB runs of the grid map.
+     * @param h: channel of each RB of the allocation (num_rb values per antenna pair).
+     * @param num_rb: number of RBs (up to MAX_NUM_RB).
+     * @param y: received symbols of each antenna, in data_idx order (see: demap_from_grid()).
+     * @param rb_runs: RB runs covering the REs (see: grid_map_t::data_rb_runs).
+     * @param noise_var: noise variance per RB (num_rb values, see: channel_estimate_t::noise_var).
+     * @param x: output, detected symbols per stream (same layout as y).
+     * @param sinr: output, num_rb linear post-equalization SINRs per stream.
+     */
+    inline void mmse_2x2_detect_rb(const mimo_channel_t & h, size_t num_rb, const mimo_streams_t & y,
+                                   const vector<grid_rb_run_t> & rb_runs, const float * noise_var,
+                                   const mimo_streams_t & x, float * const sinr[2])
+    {
+        assert(num_rb <= MAX_NUM_RB);
+        complex<float> w[MAX_NUM_RB][2][2];
+        for (size_t rb=0; rb<num_rb; rb++){
+            const float n0 = max(noise_var[rb], MIMO_MIN_NOISE_VAR);
+            complex<float> c[2][2];
+            for (int r=0; r<2; r++){
+                for (int t=0; t<2; t++){
+                    c[r][t] = complex<float>(h.re[r][t][rb], h.im[r][t][rb]);
+                }
+            }
+            float s_rb[2];
+            mmse_2x2_filter(c, n0, w[rb], s_rb);
+            sinr[0][rb] = s_rb[0];
+            sinr[1][rb] = s_rb[1];
+        }
+        for (const auto & run : rb_runs){
+            assert(run.rb < num_rb);
+            mmse_2x2_apply(w[run.rb], y, run.first, run.length, x);
+        }
+    }
+
+#if defined(__AVX2__)
+    /**
+     * @brief AVX2 Alamouti combining kernel (8 RE pairs per iteration, see: alamouti_combine()).
+     *
+     * Even/odd REs are split with in-lane shuffles; unpacking the two combined streams restores the RE order.
+     * @return Number of REs processed; the tail is left to the scalar code.
+     */
+    inline size_t alamouti_combine_avx2(const mimo_channel_t & h, size_t num_rx, const mimo_streams_t & y,
+                                        size_t n, float n0, float * x_re, float * x_im, float * sinr)
+    {
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 vn0 = _mm256_set1_ps(n0);
+        const __m256 vmin = _mm256_set1_ps(MIMO_MIN_DET);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        size_t i = 0;
+        for (; i+16<=n; i+=16){
+            __m256 s1r = _mm256_setzero_ps(), s1i = _mm256_setzero_ps();
+            __m256 s2r = _mm256_setzero_ps(), s2i = _mm256_setzero_ps();
+            __m256 g = _mm256_setzero_ps();
+            for (size_t r=0; r<num_rx; r++){
+                __m256 v[6][2];
+                const float * src[6] = {h.re[r][0], h.im[r][0], h.re[r][1], h.im[r][1], y.re[r], y.im[r]};
+                for (int k=0; k<6; k++){
+                    __m256 lo = _mm256_loadu_ps(src[k]+i);
+                    __m256 hi = _mm256_loadu_ps(src[k]+i+8);
+                    v[k][0] = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2,0,2,0));   // First RE of each pair
+                    v[k][1] = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3,1,3,1));   // Second RE of each pair
+                }
+                // Channel averaged over the pair
+                __m256 h1r = _mm256_mul_ps(_mm256_add_ps(v[0][0], v[0][1]), half);
+                __m256 h1i = _mm256_mul_ps(_mm256_add_ps(v[1][0], v[1][1]), half);
+                __m256 h2r = _mm256_mul_ps(_mm256_add_ps(v[2][0], v[2][1]), half);
+                __m256 h2i = _mm256_mul_ps(_mm256_add_ps(v[3][0], v[3][1]), half);
+                __m256 ar = v[4][0], ai = v[5][0];
+                __m256 br = v[4][1], bi = v[5][1];
+                // s1 += h1* ya + h2 yb*, s2 += h2* ya - h1 yb*
+                s1r = _mm256_add_ps(s1r, _mm256_add_ps(cmulc_re_avx2(h1r, h1i, ar, ai), cmulc_re_avx2(br, bi, h2r, h2i)));
+                s1i = _mm256_add_ps(s1i, _mm256_add_ps(cmulc_im_avx2(h1r, h1i, ar, ai), cmulc_im_avx2(br, bi, h2r, h2i)));
+                s2r = _mm256_add_ps(s2r, _mm256_sub_ps(cmulc_re_avx2(h2r, h2i, ar, ai), cmulc_re_avx2(br, bi, h1r, h1i)));
+                s2i = _mm256_add_ps(s2i, _mm256_sub_ps(cmulc_im_avx2(h2r, h2i, ar, ai), cmulc_im_avx2(br, bi, h1r, h1i)));
+                g = _mm256_add_ps(g, _mm256_add_ps(cmulc_re_avx2(h1r, h1i, h1r, h1i), cmulc_re_avx2(h2r, h2i, h2r, h2i)));
+            }
+            g = _mm256_max_ps(g, vmin);
+            __m256 inv = _mm256_div_ps(one, g);
+            s1r = _mm256_mul_ps(s1r, inv);
+            s1i = _mm256_mul_ps(s1i, inv);
+            s2r = _mm256_mul_ps(s2r, inv);
+            s2i = _mm256_mul_ps(s2i, inv);
+            __m256 snr = _mm256_div_ps(g, vn0);
+            _mm256_storeu_ps(x_re+i, _mm256_unpacklo_ps(s1r, s2r));
+            _mm256_storeu_ps(x_re+i+8, _mm256_unpackhi_ps(s1r, s2r));
+            _mm256_storeu_ps(x_im+i, _mm256_unpacklo_ps(s1i, s2i));
+            _mm256_storeu_ps(x_im+i+8, _mm256_unpackhi_ps(s1i, s2i));
+            _mm256_storeu_ps(sinr+i, _mm256_unpacklo_ps(snr, snr));
+            _mm256_storeu_ps(sinr+i+8, _mm256_unpackhi_ps(snr, snr));
+        }
+        return i;
+    }
+#endif
+
+    /**
+     * @brief Batched Alamouti (space time block code) combiner for 2 transmit antennas (DIVERSITY).
+     *
+     * REs 2p and 2p+1 carry the pair (s1, s2) as [s1, s2] and [-s2*, s1*] on transmit antennas 1 and 2. The
+     * channel is taken as the average of both REs and the combined symbols are normalized by the channel
+     * gain g = sum |h|^2, leaving unit gain symbols with SINR g/N0 on both REs of the pair.
+     * @param h: channel of each RE (only h.re[r]/h.im[r] of the num_rx antennas are read).
+     * @param num_rx: number of receive antennas (1 or 2).
+     * @param y: received symbols of each antenna.
+     * @param n: number of REs (even; the last RE of an odd n is left untouched).
+     * @param noise_var: noise variance N0.
+     * @param x_re: output, n detected symbols (real part) in RE order: s1, s2 of each pair.
+     * @param x_im: output, imaginary part.
+     * @param sinr: output, n linear post-combining SINRs.
+     */
+    inline void alamouti_combine(const mimo_channel_t & h, size_t num_rx, const mimo_streams_t & y, size_t n,
+                                 float noise_var, float * x_re, float * x_im, float * sinr)
+    {
+        const float n0 = max(noise_var, MIMO_MIN_NOISE_VAR);
+        num_rx = min(max(num_rx, size_t(1)), size_t(2));
+        size_t i = 0;
+#if defined(__AVX2__)
+        i = alamouti_combine_avx2(h, num_rx, y, n, n0, x_re, x_im, sinr);
+#endif
+        for (; i+2<=n; i+=2){
+            complex<float> s1(0, 0), s2(0, 0);
+            float g = 0;
+            for (size_t r=0; r<num_rx; r++){
+                complex<float> h1 = 0.5f*complex<float>(h.re[r][0][i] + h.re[r][0][i+1], h.im[r][0][i] + h.im[r][0][i+1]);
+                complex<float> h2 = 0.5f*complex<float>(h.re[r][1][i] + h.re[r][1][i+1], h.im[r][1][i] + h.im[r][1][i+1]);
+                complex<float> ya(y.re[r][i], y.im[r][i]);
+                complex<float> yb(y.re[r][i+1], y.im[r][i+1]);
+                s1 += conj(h1)*ya + h2*conj(yb);
+                s2 += conj(h2)*ya - h1*conj(yb);
+                g += norm(h1) + norm(h2);
+            }
+            g = max(g, MIMO_MIN_DET);
+            s1 /= g;
+            s2 /= g;
+            x_re[i] = s1.real();
+            x_im[i] = s1.imag();
+            x_re[i+1] = s2.real();
+            x_im[i+1] = s2.imag();
+            sinr[i] = sinr[i+1] = g / n0;
+        }
+    }
+
+    /**
+     * @brief Rank indicator (as in RxMetrics::rankIndicator) from the channel of a set of REs.
+     *
+     * Compares the average rate of spatial multiplexing with the MMSE detector, sum log2(1 + sinr_k), with
+     * the rate of Alamouti transmission, log2(1 + |H|^2/N0), and returns 2 if multiplexing is better.
+     * @param h: channel (2x2) of each RE.
+     * @param n: number of REs.
+     * @param noise_var: noise variance N0.
+     * @param step: RE decimation (1: every RE).
+     */
+    inline uint8_t mimo_rank_indicator(const mimo_channel_t & h, size_t n, float noise_var, size_t step = 1)
+    {
+        const float n0 = max(noise_var, MIMO_MIN_NOISE_VAR);
+        if (step==0){step = 1;}
+        double rate1 = 0, rate2 = 0;
+        for (size_t i=0; i<n; i+=step){
+            complex<float> hi[2][2];
+            float g = 0;
+            for (int r=0; r<2; r++){
+                for (int t=0; t<2; t++){
+                    hi[r][t] = complex<float>(h.re[r][t][i], h.im[r][t][i]);
+                    g += norm(hi[r][t]);
+                }
+            }
+            const float a = norm(hi[0][0]) + norm(hi[1][0]) + n0;
+            const float d = norm(hi[0][1]) + norm(hi[1][1]) + n0;
+            const float bb = norm(conj(hi[0][0])*hi[0][1] + conj(hi[1][0])*hi[1][1]);
+            const float u1 = max(d*(a-n0) - bb, 0.0f);
+            const float u2 = max(a*(d-n0) - bb, 0.0f);
+            rate2 += log2f((1 + u1/(n0*d)) * (1 + u2/(n0*a)));
+            rate1 += log2f(1 + g/n0);
+        }
+        return rate2 > rate1 ? 2 : 1;
+    }
+
+    /**
+     * @brief Converts per RB post-equalization SINRs (see: mmse_2x2_detect_rb()) into noise variances.
+     *
+     * The noise variance of an unbiased symbol is 1/sinr.
+     * @param sinr: linear SINR of each RB.
+     * @param num_rb: number of RBs.
+     * @param noise_var: vector where the noise variance per RB will be stored.
+     */
+    inline void sinr_to_noise_var(const float * sinr, size_t num_rb, vector<float> & noise_var)
+    {
+        noise_var.resize(num_rb);
+        for (size_t rb=0; rb<num_rb; rb++){
+            noise_var[rb] = 1.0f/max(sinr[rb], MIMO_MIN_DET);
+        }
+    }
+
+    /**
+     * @brief Converts per RE post-equalization SINRs (see: mmse_2x2_detect()) into noise variances per RB.
+     *
+     * The noise variance of an unbiased symbol is 1/sinr; the RB value is the average over its REs, whose
+     * RB comes from the RB runs of the grid map (REs in data_idx order).
+     * @param sinr: linear SINR of each RE, in data_idx order.
+     * @param rb_runs: RB runs covering the REs (see: grid_map_t::data_rb_runs).
+     * @param num_rb: number of RBs of the allocation.
+     * @param noise_var: vector where the noise variance per RB will be stored (0 for RBs without REs).
+     */
+    inline void sinr_to_noise_var(const float * sinr, const vector<grid_rb_run_t> & rb_runs, size_t num_rb,
+                                  vector<float> & noise_var)
+    {
+        noise_var.assign(num_rb, 0.0f);
+        vector<uint32_t> count(num_rb, 0);
+        for (const auto & run : rb_runs){
+            assert(run.rb < num_rb);
+            float sum = 0;
+            for (size_t j=0; j<run.length; j++){
+                sum += 1.0f/max(sinr[run.first+j], MIMO_MIN_DET);
+            }
+            noise_var[run.rb] += sum;
+            count[run.rb] += run.length;
+        }
+        for (size_t rb=0; rb<num_rb; rb++){
+            if (count[rb] > 0){noise_var[rb] /= count[rb];}
+        }
+    }
+
+} /* namespace lib5grange */
+#endif /* INCLUDED_LIB5GRANGE_MIMO_DETECTOR_H */
@@ -0,0 +1,233 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_LIB5GRANGE_SDU_PACKER_H
+#define INCLUDED_LIB5GRANGE_SDU_PACKER_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <functional>
+#include "lib5grange.h"
+
+/** Largest SDU (segment) length of a 2 byte subheader **/
+#define SDU_SHORT_MAX_LEN (0x1FFF)
+/** Largest SDU (segment) length of a 3 byte subheader **/
+#define SDU_LONG_MAX_LEN  (0x1FFFFF)
+
+/** Segmentation info values (two most significant bits of the subheader) **/
+#define SDU_SI_COMPLETE (0x0)
+#define SDU_SI_FIRST    (0x1)
+#define SDU_SI_LAST     (0x2)
+#define SDU_SI_MIDDLE   (0x3)
+
+namespace lib5grange {
+    using namespace std;
+
+    /** Non-owning view of a sequence of bytes **/
+    typedef struct {
+        const uint8_t * data;   /**< First byte **/
+        size_t size;            /**< Number of bytes **/
+    } byte_span_t;
+
+    /** SDU or SDU segment found in a mac_data_ buffer **/
+    typedef struct {
+        byte_span_t data;       /**< Bytes of the SDU (points into mac_data_) **/
+        uint8_t si;             /**< Segmentation info (SDU_SI_*) **/
+    } sdu_segment_t;
+
+    /**
+     * mac_data_ layout: a sequence of [subheader][SDU bytes] entries followed by zero padding.
+     * Subheader byte 0: SI (2 bits) | L flag (1 bit) | 5 most significant bits of the length,
+     * then 1 (L=0) or 2 (L=1) more length bytes, big endian. A zero length ends the list.
+     */
+
+    /** @brief Size of the subheader needed for a segment of len bytes **/
+    inline size_t sdu_subheader_size(size_t len)
+    {
+        return len > SDU_SHORT_MAX_LEN ? 3 : 2;
+    }
+
+    /**
+     * @brief Packs queued upper layer packets (e.g. IP packets in TUN_ENABLED mode) into mac_data_.
+     *
+     * Packets are queued either as spans, which must stay valid until packed, or as vectors moved into
+     * the packer. Packing copies each packet (or segment) once with memcpy; packets that do not fit in
+     * the remaining space are segmented and continue in the next PDU.
+     */
+    class SduPacker {
+        private:
+            typedef struct {
+                vector<uint8_t> owned;  /**< Adopted buffer (empty for spans) **/
+                const uint8_t * data;
+                size_t size;
+                size_t offset;          /**< Bytes already packed **/
+            } sdu_entry_t;
+
+            deque<sdu_entry_t> queue_;
+            size_t pending_bytes_ = 0;
+
+        public:
+            /** @brief Queues a packet by reference (memory must outlive its packing) **/
+            void push(const byte_span_t & sdu){
+                if (sdu.size == 0){return;}
+                queue_.push_back({vector<uint8_t>(), sdu.data, sdu.size, 0});
+                pending_bytes_ += sdu.size;
+            }
+
+            /** @brief Queues a packet, adopting its buffer without copying **/
+            void push(vector<uint8_t> && sdu){
+                if (sdu.empty()){return;}
+                queue_.push_back({move(sdu), nullptr, 0, 0});
+                sdu_entry_t & e = queue_.back();
+                e.data = e.owned.data();
+                e.size = e.owned.size();
+                pending_bytes_ += e.size;
+            }
+
+            /** @brief Number of queued packets (including a partially packed one) **/
+            size_t pending() const {return queue_.size();}
+
+            /** @brief Number of queued bytes not packed yet **/
+            size_t pending_bytes() const {return pending_bytes_;}
+
+            /**
+             * @brief Fills a buffer with queued packets
+             * @param mac_data: buffer, resized to capacity; unused bytes are zero padding.
+             * @param capacity: number of bytes available.
+             * @return Number of SDU bytes packed (subheaders not included).
+             */
+            size_t pack(vector<uint8_t> & mac_data, size_t capacity){
+                mac_data.resize(capacity);
+                uint8_t * out = mac_data.data();
+                size_t pos = 0, packed = 0;
+                while (!queue_.empty()){
+                    sdu_entry_t & e = queue_.front();
+                    const size_t left = e.size - e.offset;
+                    const size_t remain = capacity - pos;
+                    const size_t hl = sdu_subheader_size(min(left, remain));
+                    if (remain <= hl){break;}
+                    const size_t chunk = min(min(left, remain - hl), (size_t) SDU_LONG_MAX_LEN);
+                    const bool first = (e.offset == 0);
+                    const bool last = (e.offset + chunk == e.size);
+                    const uint8_t si = first ? (last ? SDU_SI_COMPLETE : SDU_SI_FIRST) : (last ? SDU_SI_LAST : SDU_SI_MIDDLE);
+                    if (hl == 2){
+                        out[pos]   = (si<<6) | ((chunk>>8) & 0x1F);
+                        out[pos+1] = chunk & 0xFF;
+                    }
+                    else{
+                        out[pos]   = (si<<6) | 0x20 | ((chunk>>16) & 0x1F);
+                        out[pos+1] = (chunk>>8) & 0xFF;
+                        out[pos+2] = chunk & 0xFF;
+                    }
+                    memcpy(out + pos + hl, e.data + e.offset, chunk);
+                    pos += hl + chunk;
+                    packed += chunk;
+                    e.offset += chunk;
+                    pending_bytes_ -= chunk;
+                    if (last){queue_.pop_front();}
+                }
+                if (pos < capacity){
+                    memset(out + pos, 0, capacity - pos);
+                }
+                return packed;
+            }
+
+            /**
+             * @brief Fills mac_data_ of a PDU up to get_net_byte_capacity()
+             * @param pdu: MacPDU object with its configuration already set; mcs_.num_info_bytes is updated.
+             * @param coderate: code rate used to compute the net capacity.
+             * @return Number of SDU bytes packed.
+             */
+            size_t pack(MacPDU & pdu, float coderate){
+                size_t capacity = get_net_byte_capacity(coderate, pdu);
+                size_t packed = pack(pdu.mac_data_, capacity);
+                pdu.mcs_.num_info_bytes = capacity;
+                return packed;
+            }
+    }; /* class SduPacker */
+
+    /**
+     * @brief Parses a packed buffer into spans pointing into it (no copies)
+     * @param mac_data: buffer filled by SduPacker::pack().
+     * @param segments: vector where the SDUs and segments are stored, in order.
+     * @return false if the buffer is malformed (segments found up to that point are kept).
+     */
+    inline bool unpack_sdus(const vector<uint8_t> & mac_data, vector<sdu_segment_t> & segments)
+    {
+        segments.clear();
+        const uint8_t * in = mac_data.data();
+        const size_t size = mac_data.size();
+        size_t pos = 0;
+        while (pos + 2 <= size){
+            const uint8_t si = in[pos] >> 6;
+            const bool long_hdr = (in[pos] & 0x20) != 0;
+            size_t len, hl;
+            if (long_hdr){
+                if (pos + 3 > size){return false;}
+                len = (size_t(in[pos] & 0x1F)<<16) | (size_t(in[pos+1])<<8) | in[pos+2];
+                hl = 3;
+            }
+            else{
+                len = (size_t(in[pos] & 0x1F)<<8) | in[pos+1];
+                hl = 2;
+            }
+            if (len == 0){break;}
+            if (pos + hl + len > size){return false;}
+            segments.push_back({{in + pos + hl, len}, si});
+            pos += hl + len;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Rebuilds segmented SDUs across PDUs.
+     *
+     * Complete SDUs are handed over as spans into mac_data_; only segmented ones are copied.
+     */
+    class SduReassembler {
+        private:
+            vector<uint8_t> partial_;
+            bool in_progress_ = false;
+
+        public:
+            /**
+             * @brief Processes the segments of one PDU, in order
+             * @param segments: output of unpack_sdus().
+             * @param deliver: called with every complete SDU (the span is valid during the call only).
+             * @return Number of discarded segments (lost first/last segments).
+             */
+            size_t push(const vector<sdu_segment_t> & segments, const function<void(const byte_span_t &)> & deliver){
+                size_t discarded = 0;
+                for (const auto & s : segments){
+                    switch (s.si){
+                        case SDU_SI_COMPLETE:
+                            if (in_progress_){discarded++; in_progress_ = false;}
+                            deliver(s.data);
+                            break;
+                        case SDU_SI_FIRST:
+                            if (in_progress_){discarded++;}
+                            partial_.assign(s.data.data, s.data.data + s.data.size);
+                            in_progress_ = true;
+                            break;
+                        case SDU_SI_MIDDLE:
+                        case SDU_SI_LAST:
+                            if (!in_progress_){discarded++; break;}
+                            partial_.insert(partial_.end(), s.data.data, s.data.data + s.data.size);
+                            if (s.si == SDU_SI_LAST){
+                                deliver({partial_.data(), partial_.size()});
+                                in_progress_ = false;
+                            }
+                            break;
+                    }
+                }
+                return discarded;
+            }
+    }; /* class SduReassembler */
+
+} /* namespace lib5grange */
+#endif /* INCLUDED_LIB5GRANGE_SDU_PACKER_H */
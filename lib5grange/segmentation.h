@@ -0,0 +1,296 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_LIB5GRANGE_SEGMENTATION_H
+#define INCLUDED_LIB5GRANGE_SEGMENTATION_H
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <cassert>
+#include "lib5grange.h"
+#include "work_stealing_pool.h"
+
+/** Generator polynomial of the code block CRC (x^16 + x^12 + x^5 + 1) **/
+#define POLAR_CRC_POLY (0x1021)
+
+namespace lib5grange {
+    using namespace std;
+
+    /** Layout of one code block inside a transport block **/
+    typedef struct {
+        size_t info_offset;     /**< First information bit of the block in mac_data_ **/
+        size_t info_len;        /**< Number of information bits (CRC not included) **/
+        size_t mother_len;      /**< Polar mother code length N (power of two <= POLAR_MAX_CW_LEN) **/
+        size_t out_offset;      /**< First byte of the block in coded_data_ **/
+        size_t out_len;         /**< Number of rate matched bits E (multiple of 8) **/
+    } codeblock_cfg_t;
+
+    /** Code block layout of a transport block **/
+    typedef struct {
+        size_t info_bits = 0;               /**< Information bits of the transport block **/
+        size_t coded_bits = 0;              /**< Rate matched bits of the transport block **/
+        vector<codeblock_cfg_t> blocks;     /**< Code blocks, in transmission order **/
+    } segmentation_t;
+
+    /** Per-thread scratch buffers of the code block encoder (grow to the largest block, then are reused) **/
+    typedef struct {
+        vector<uint8_t> in;         /**< Information+CRC bits of the block **/
+        vector<uint8_t> out;        /**< Rate matched bits of the block **/
+        vector<uint8_t> info_pos;   /**< Polar information set **/
+        vector<uint8_t> u;          /**< Polar transform input/output **/
+    } codeblock_scratch_t;
+
+    /** @brief Scratch buffers of the calling thread **/
+    inline codeblock_scratch_t & codeblock_scratch()
+    {
+        static thread_local codeblock_scratch_t scratch;
+        return scratch;
+    }
+
+    /**
+     * @brief Function that encodes and rate matches one code block.
+     * Arguments: information+CRC bits (one bit per byte), code block configuration, output bits (one bit per byte, out_len of them).
+     */
+    typedef function<void(const uint8_t *, const codeblock_cfg_t &, uint8_t *)> codeword_encoder_t;
+
+    /**
+     * @brief Computes the code block layout of a transport block.
+     *
+     * The number of blocks is the smallest one for which every block, CRC included, fits in a
+     * POLAR_MAX_CW_LEN codeword at the target code rate. Information bits and coded bytes are spread as
+     * evenly as possible, and each block uses the smallest mother code length not below its output length
+     * (capped at POLAR_MAX_CW_LEN, repetition covers the rest).
+     *
+     * @param info_bits: number of information bits.
+     * @param coded_bytes: number of rate matched bytes (see: mcs_cfg_t::num_coded_bytes).
+     * @param coderate: target code rate.
+     * @param seg: struct where the layout is stored.
+     * @return false if some block cannot carry its information and CRC bits (fewer output bits than
+     * info_len + POLAR_CRC_LEN, or more than POLAR_MAX_CW_LEN of them); the blocks are then cleared.
+     */
+    inline bool compute_segmentation(size_t info_bits, size_t coded_bytes, float coderate, segmentation_t & seg)
+    {
+        seg.info_bits = info_bits;
+        seg.coded_bits = coded_bytes*8;
+        seg.blocks.clear();
+        if (info_bits == 0 || coded_bytes == 0){return true;}
+
+        long max_info = long(floorf(coderate*POLAR_MAX_CW_LEN)) - POLAR_CRC_LEN;
+        if (max_info < 1){max_info = 1;}
+        size_t num_blocks = (info_bits + max_info - 1)/max_info;
+        num_blocks = min(num_blocks, coded_bytes);  // every block gets at least one byte
+
+        size_t info_offset = 0, out_offset = 0;
+        for (size_t c=0; c<num_blocks; c++){
+            codeblock_cfg_t cb;
+            cb.info_offset = info_offset;
+            cb.info_len = info_bits/num_blocks + (c < info_bits%num_blocks ? 1 : 0);
+            cb.out_offset = out_offset;
+            cb.out_len = 8*(coded_bytes/num_blocks + (c < coded_bytes%num_blocks ? 1 : 0));
+            size_t n = 1;
+            while (n < cb.out_len && n < POLAR_MAX_CW_LEN){n <<= 1;}
+            while (n < cb.info_len + POLAR_CRC_LEN && n < POLAR_MAX_CW_LEN){n <<= 1;}
+            cb.mother_len = n;
+            if (cb.out_len < cb.info_len + POLAR_CRC_LEN || cb.info_len + POLAR_CRC_LEN > cb.mother_len){
+                seg.blocks.clear();
+                return false;
+            }
+            info_offset += cb.info_len;
+            out_offset += cb.out_len/8;
+            seg.blocks.push_back(cb);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Computes the code block layout of a PDU
+     * @param pdu: MacPDU object; mac_data_ holds the information bytes and mcs_.num_coded_bytes the output size.
+     * @param coderate: target code rate.
+     * @param seg: struct where the layout is stored.
+     * @return false if the coded size is too small for the information bits (see: above).
+     */
+    inline bool compute_segmentation(const MacPDU & pdu, float coderate, segmentation_t & seg)
+    {
+        return compute_segmentation(pdu.mac_data_.size()*8, pdu.mcs_.num_coded_bytes, coderate, seg);
+    }
+
+    /** @brief CRC of a sequence of bits (one bit per byte), POLAR_CRC_LEN bits long **/
+    inline uint16_t crc16_bits(const uint8_t * bits, size_t len)
+    {
+        uint16_t crc = 0;
+        for (size_t i=0; i<len; i++){
+            bool feedback = ((crc >> 15) & 1) ^ (bits[i] & 1);
+            crc <<= 1;
+            if (feedback){crc ^= POLAR_CRC_POLY;}
+        }
+        return crc;
+    }
+
+    /**
+     * @brief Polar reliability order for a mother code length (most reliable index first).
+     *
+     * Uses the polarization weight construction, W(i) = sum of 2^(j/4) over the set bits j of i.
+     * Orders are computed once per length.
+     */
+    inline const vector<uint16_t> & polar_reliability_order(size_t n)
+    {
+        static vector<uint16_t> orders[12];
+        static once_flag flags[12];
+        unsigned log2n = 0;
+        while ((size_t(1)<<log2n) < n){log2n++;}
+        call_once(flags[log2n], [log2n](){
+            const size_t len = size_t(1)<<log2n;
+            vector<double> weight(len);
+            auto & order = orders[log2n];
+            order.resize(len);
+            for (size_t i=0; i<len; i++){
+                weight[i] = 0;
+                for (unsigned j=0; j<log2n; j++){
+                    if ((i>>j)&1){weight[i] += pow(2.0, j/4.0);}
+                }
+                order[i] = i;
+            }
+            stable_sort(order.begin(), order.end(), [&](uint16_t a, uint16_t b){return weight[a] > weight[b];});
+        });
+        return orders[log2n];
+    }
+
+    /**
+     * @brief Default code block encoder: polar code with puncturing or repetition rate matching.
+     *
+     * When E < N the first N-E codeword bits are punctured and the matching input bits are frozen;
+     * when E > N the codeword is repeated circularly. Requires K+CRC <= min(E, N) (see: compute_segmentation()).
+     * Works on the scratch buffers of the calling thread (see: codeblock_scratch()).
+     */
+    inline void polar_encode_codeword(const uint8_t * bits, const codeblock_cfg_t & cb, uint8_t * out)
+    {
+        const size_t n = cb.mother_len;
+        const size_t k = cb.info_len + POLAR_CRC_LEN;
+        const size_t e = cb.out_len;
+        const size_t punctured = e < n ? n - e : 0;
+        assert(k <= n && k <= e);
+        codeblock_scratch_t & scratch = codeblock_scratch();
+
+        // Raw pointers and locals: byte stores into the scratch buffers could otherwise alias them
+        const uint16_t * order = polar_reliability_order(n).data();
+        scratch.info_pos.assign(n, 0);
+        scratch.u.assign(n, 0);
+        uint8_t * info_pos = scratch.info_pos.data();
+        uint8_t * u = scratch.u.data();
+        size_t selected = 0;
+        for (size_t i=0; i<n && selected<k; i++){
+            if (order[i] >= punctured){
+                info_pos[order[i]] = 1;
+                selected++;
+            }
+        }
+        for (size_t i=0, j=0; i<n && j<selected; i++){
+            if (info_pos[i]){u[i] = bits[j++];}
+        }
+        for (size_t h=1; h<n; h<<=1){
+            for (size_t i=0; i<n; i+=2*h){
+                for (size_t j=0; j<h; j++){
+                    u[i+j] ^= u[i+j+h];
+                }
+            }
+        }
+        for (size_t j=0; j<e; j++){
+            out[j] = punctured ? u[punctured + j] : u[j % n];
+        }
+    }
+
+    /**
+     * @brief Segments, encodes and rate matches the transport block of a MacPDU.
+     *
+     * Code blocks are independent, so they can be spread over the pool (or run sequentially when no pool
+     * is given), each one writing its own byte range of coded_data_. Each block works on the scratch
+     * buffers of the thread running it (see: codeblock_scratch()), so no allocation happens per block
+     * once the buffers have grown to the largest block. See example/segmentation_bench.cpp for timings.
+     */
+    class TransportBlockEncoder {
+        private:
+            WorkStealingPool * pool_;
+            codeword_encoder_t encoder_;
+
+        public:
+            /**
+             * @brief Construct a new TransportBlockEncoder object
+             * @param pool: pool used to encode code blocks concurrently (nullptr for the calling thread only).
+             * @param encoder: code block encoder (defaults to polar_encode_codeword()).
+             */
+            TransportBlockEncoder(WorkStealingPool * pool = nullptr, codeword_encoder_t encoder = polar_encode_codeword)
+            : pool_(pool), encoder_(encoder) {}
+
+            /**
+             * @brief Encodes a set of information bytes following a layout
+             * @param info: information bytes (MSB first).
+             * @param seg: code block layout (see: compute_segmentation()).
+             * @param coded: output, resized to seg.coded_bits/8 bytes.
+             */
+            void encode(const vector<uint8_t> & info, const segmentation_t & seg, vector<uint8_t> & coded){
+                coded.assign(seg.coded_bits/8, 0);
+                auto encode_block = [&](size_t c){
+                    // Copies and raw pointers: byte stores into the scratch buffers could alias the layout
+                    const codeblock_cfg_t cb = seg.blocks[c];
+                    const uint8_t * src = info.data();
+                    codeblock_scratch_t & scratch = codeblock_scratch();
+                    scratch.in.resize(cb.info_len + POLAR_CRC_LEN);
+                    scratch.out.resize(cb.out_len);
+                    uint8_t * in = scratch.in.data();
+                    uint8_t * out = scratch.out.data();
+                    for (size_t i=0; i<cb.info_len; i++){
+                        size_t bit = cb.info_offset + i;
+                        in[i] = (src[bit/8] >> (7 - bit%8)) & 1;
+                    }
+                    uint16_t crc = crc16_bits(in, cb.info_len);
+                    for (size_t i=0; i<POLAR_CRC_LEN; i++){
+                        in[cb.info_len + i] = (crc >> (POLAR_CRC_LEN-1-i)) & 1;
+                    }
+                    encoder_(in, cb, out);
+                    uint8_t * dst = coded.data() + cb.out_offset;
+                    for (size_t i=0; i<cb.out_len; i+=8){
+                        uint8_t byte = 0;
+                        for (size_t b=0; b<8; b++){byte = (byte<<1) | (out[i+b] & 1);}
+                        dst[i/8] = byte;
+                    }
+                };
+                if (pool_ != nullptr){
+                    pool_->parallel_for(seg.blocks.size(), encode_block);
+                }
+                else{
+                    for (size_t c=0; c<seg.blocks.size(); c++){encode_block(c);}
+                }
+            }
+
+            /**
+             * @brief Encodes mac_data_ of a PDU into coded_data_
+             *
+             * If mcs_.num_coded_bytes is zero it is set to the gross capacity of the allocation
+             * (get_bit_capacity()/8). mcs_.num_info_bytes is set to the size of mac_data_.
+             *
+             * @param pdu: MacPDU object to be encoded.
+             * @param coderate: target code rate (see: mcsToCodeRate).
+             * @return false if num_coded_bytes is too small for mac_data_ (coded_data_ is left untouched).
+             */
+            bool encode(MacPDU & pdu, float coderate){
+                if (pdu.mcs_.num_coded_bytes == 0){
+                    pdu.mcs_.num_coded_bytes = get_bit_capacity(pdu)/8;
+                }
+                pdu.mcs_.num_info_bytes = pdu.mac_data_.size();
+                segmentation_t seg;
+                if (!compute_segmentation(pdu, coderate, seg)){return false;}
+                encode(pdu.mac_data_, seg, pdu.coded_data_);
+                return true;
+            }
+    }; /* class TransportBlockEncoder */
+
+} /* namespace lib5grange */
+#endif /* INCLUDED_LIB5GRANGE_SEGMENTATION_H */
@@ -0,0 +1,329 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_LIB5GRANGE_SOFT_DEMAPPER_H
+#define INCLUDED_LIB5GRANGE_SOFT_DEMAPPER_H
+
+#include <cstdint>
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#include "lib5grange.h"
+#include "grid_map.h"
+
+/** Number of symbols demapped per block when producing int8 LLRs **/
+#define DEMAP_BLOCK_SYMBOLS (64)
+
+/** Largest magnitude of a quantized int8 LLR (symmetric range) **/
+#define LLR_INT8_MAX (127)
+
+namespace lib5grange {
+    using namespace std;
+
+    /**
+     * @brief Scale that takes a unit-energy QAM symbol back to the odd integer grid (+-1, +-3, ...).
+     *
+     * Constellations are the square Gray-mapped ones of 3GPP TS 36.211 (sec. 7.1): bit 2i of a
+     * symbol is carried by the in-phase component and bit 2i+1 by the quadrature component,
+     * most significant level first.
+     *
+     * @param mod: QAM modulation (QPSK, QAM16, QAM64 or QAM256).
+     * @return float
+     */
+    inline float qam_grid_scale(const qammod_t & mod)
+    {
+        switch (mod){
+            case QPSK:   return sqrtf(2.0f);
+            case QAM16:  return sqrtf(10.0f);
+            case QAM64:  return sqrtf(42.0f);
+            case QAM256: return sqrtf(170.0f);
+        }
+        return 1.0f;
+    }
+
+    /**
+     * @brief Converts per RB SNR values in dB (as in RxMetrics::snr) into noise variances.
+     *
+     * @param snr_db: SNR per resource block in dB.
+     * @param noise_var: vector where the noise variance per RB will be stored.
+     * @param signal_power: Average received symbol power (1 for unit-energy constellations).
+     */
+    inline void snr_to_noise_var(const vector<float> & snr_db, vector<float> & noise_var, float signal_power = 1.0f)
+    {
+        noise_var.resize(snr_db.size());
+        for (size_t i=0; i<snr_db.size(); i++){
+            noise_var[i] = signal_power / powf(10.0f, snr_db[i]/10.0f);
+        }
+    }
+
+    /**
+     * @brief Scalar max-log demapper for a run of symbols sharing the same noise variance.
+     *
+     * Each dimension is demapped independently: L0 = y and Lk = Ak - |Lk-1|, with y on the
+     * integer grid and Ak = 2^(levels-k). The result is multiplied by 4/(s^2 N0).
+     *
+     * @param y: received symbols.
+     * @param n: number of symbols.
+     * @param levels: bits per dimension (modulation/2).
+     * @param s: grid scale (see: qam_grid_scale()).
+     * @param gain: LLR gain 4/(s^2 N0).
+     * @param llr: output, n*2*levels LLRs (positive values favour bit 0).
+     */
+    inline void demap_maxlog_scalar(const complex<float> * y, size_t n, unsigned levels, float s, float gain, float * llr)
+    {
+        const unsigned nbits = 2*levels;
+        for (size_t i=0; i<n; i++){
+            float d[2] = {y[i].real()*s, y[i].imag()*s};
+            float * out = llr + i*nbits;
+            for (unsigned c=0; c<2; c++){
+                float l = d[c];
+                out[c] = gain*l;
+                for (unsigned k=1; k<levels; k++){
+                    l = float(1u<<(levels-k)) - fabsf(l);
+                    out[2*k+c] = gain*l;
+                }
+            }
+        }
+    }
+
+#if defined(__AVX2__)
+    /**
+     * @brief Stores 4 symbols worth of LLRs given one vector per level.
+     *
+     * Each l[k] holds the (I,Q) LLR pairs of level k for 4 consecutive symbols. The 4x4 transpose
+     * of 64-bit pairs yields one vector per symbol, of which only 2*levels floats are written.
+     */
+    inline void store_llr_pairs_avx2(const __m256 * l, unsigned levels, float * out)
+    {
+        const unsigned stride = 2*levels;
+        __m256d t0 = _mm256_unpacklo_pd(_mm256_castps_pd(l[0]), _mm256_castps_pd(l[1]));
+        __m256d t1 = _mm256_unpackhi_pd(_mm256_castps_pd(l[0]), _mm256_castps_pd(l[1]));
+        __m256d t2 = _mm256_unpacklo_pd(_mm256_castps_pd(l[2]), _mm256_castps_pd(l[3]));
+        __m256d t3 = _mm256_unpackhi_pd(_mm256_castps_pd(l[2]), _mm256_castps_pd(l[3]));
+        __m256 r[4];
+        r[0] = _mm256_castpd_ps(_mm256_permute2f128_pd(t0, t2, 0x20));
+        r[1] = _mm256_castpd_ps(_mm256_permute2f128_pd(t1, t3, 0x20));
+        r[2] = _mm256_castpd_ps(_mm256_permute2f128_pd(t0, t2, 0x31));
+        r[3] = _mm256_castpd_ps(_mm256_permute2f128_pd(t1, t3, 0x31));
+        const __m256i mask6 = _mm256_setr_epi32(-1, -1, -1, -1, -1, -1, 0, 0);
+        for (unsigned j=0; j<4; j++){
+            switch (levels){
+                case 2:  _mm_storeu_ps(out + j*stride, _mm256_castps256_ps128(r[j])); break;
+                case 3:  _mm256_maskstore_ps(out + j*stride, mask6, r[j]); break;
+                default: _mm256_storeu_ps(out + j*stride, r[j]); break;
+            }
+        }
+    }
+
+    /**
+     * @brief AVX2 max-log kernel (4 symbols per iteration).
+     * @return Number of symbols processed; the tail is left to the scalar kernel.
+     */
+    inline size_t demap_maxlog_avx2(const complex<float> * y, size_t n, unsigned levels, float s, float gain, float * llr)
+    {
+        const __m256 vs = _mm256_set1_ps(s);
+        const __m256 vg = _mm256_set1_ps(gain);
+        const __m256 absmask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        size_t i = 0;
+        for (; i+4<=n; i+=4){
+            __m256 d = _mm256_mul_ps(_mm256_loadu_ps((const float*)(y+i)), vs);
+            __m256 l[4];
+            l[0] = _mm256_mul_ps(d, vg);
+            for (unsigned k=1; k<4; k++){
+                if (k < levels){
+                    d = _mm256_sub_ps(_mm256_set1_ps(float(1u<<(levels-k))), _mm256_and_ps(d, absmask));
+                    l[k] = _mm256_mul_ps(d, vg);
+                }
+                else{
+                    l[k] = _mm256_setzero_ps();
+                }
+            }
+            if (levels==1){
+                _mm256_storeu_ps(llr + 2*i, l[0]);
+            }
+            else{
+                store_llr_pairs_avx2(l, levels, llr + i*2*levels);
+            }
+        }
+        return i;
+    }
+#endif
+
+#if defined(__AVX512F__) && defined(__AVX2__)
+    /**
+     * @brief AVX-512 max-log kernel (8 symbols per iteration).
+     * The per-level arithmetic runs on 512-bit vectors and each half is interleaved with the AVX2 transpose.
+     * @return Number of symbols processed.
+     */
+    inline size_t demap_maxlog_avx512(const complex<float> * y, size_t n, unsigned levels, float s, float gain, float * llr)
+    {
+        const __m512 vs = _mm512_set1_ps(s);
+        const __m512 vg = _mm512_set1_ps(gain);
+        size_t i = 0;
+        for (; i+8<=n; i+=8){
+            __m512 d = _mm512_mul_ps(_mm512_loadu_ps((const float*)(y+i)), vs);
+            __m512 l[4];
+            l[0] = _mm512_mul_ps(d, vg);
+            for (unsigned k=1; k<4; k++){
+                if (k < levels){
+                    d = _mm512_sub_ps(_mm512_set1_ps(float(1u<<(levels-k))), _mm512_abs_ps(d));
+                    l[k] = _mm512_mul_ps(d, vg);
+                }
+                else{
+                    l[k] = _mm512_setzero_ps();
+                }
+            }
+            if (levels==1){
+                _mm512_storeu_ps(llr + 2*i, l[0]);
+                continue;
+            }
+            __m256 lo[4], hi[4];
+            for (unsigned k=0; k<4; k++){
+                lo[k] = _mm512_castps512_ps256(l[k]);
+                hi[k] = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(l[k]), 1));
+            }
+            store_llr_pairs_avx2(lo, levels, llr + i*2*levels);
+            store_llr_pairs_avx2(hi, levels, llr + (i+4)*2*levels);
+        }
+        return i;
+    }
+#endif
+
+    /**
+     * @brief Max-log soft demapper for symbols sharing the same noise variance.
+     *
+     * Dispatches to the widest kernel available at compile time (AVX-512, AVX2) and
+     * finishes the tail with the scalar kernel.
+     *
+     * @param y: received (equalized) symbols.
+     * @param n: number of symbols.
+     * @param mod: QAM modulation (QPSK, QAM16, QAM64 or QAM256).
+     * @param noise_var: complex noise variance N0 of the symbols.
+     * @param llr: output buffer for n*mod LLRs.
+     */
+    inline void soft_demap_maxlog(const complex<float> * y, size_t n, const qammod_t & mod, float noise_var, float * llr)
+    {
+        const unsigned levels = mod/2;
+        const float s = qam_grid_scale(mod);
+        const float gain = 4.0f/(s*s*max(noise_var, 1e-12f));
+        size_t done = 0;
+#if defined(__AVX512F__) && defined(__AVX2__)
+        done += demap_maxlog_avx512(y, n, levels, s, gain, llr);
+#endif
+#if defined(__AVX2__)
+        done += demap_maxlog_avx2(y+done, n-done, levels, s, gain, llr + done*mod);
+#endif
+        demap_maxlog_scalar(y+done, n-done, levels, s, gain, llr + done*mod);
+    }
+
+    /**
+     * @brief Quantizes float LLRs into saturated int8 values (round(llr*scale) clipped to +-127).
+     */
+    inline void quantize_llr(const float * llr, size_t n, float scale, int8_t * out)
+    {
+        size_t i = 0;
+#if defined(__AVX2__)
+        const __m256 vscale = _mm256_set1_ps(scale);
+        const __m256 vmax = _mm256_set1_ps(float(LLR_INT8_MAX));
+        const __m256 vmin = _mm256_set1_ps(-float(LLR_INT8_MAX));
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        for (; i+32<=n; i+=32){
+            __m256i q[4];
+            for (unsigned j=0; j<4; j++){
+                __m256 v = _mm256_mul_ps(_mm256_loadu_ps(llr + i + 8*j), vscale);
+                v = _mm256_min_ps(_mm256_max_ps(v, vmin), vmax);
+                q[j] = _mm256_cvtps_epi32(v);
+            }
+            __m256i p01 = _mm256_packs_epi32(q[0], q[1]);
+            __m256i p23 = _mm256_packs_epi32(q[2], q[3]);
+            __m256i b = _mm256_packs_epi16(p01, p23);
+            b = _mm256_permutevar8x32_epi32(b, order);
+            _mm256_storeu_si256((__m256i*)(out + i), b);
+        }
+#endif
+        for (; i<n; i++){
+            float v = nearbyintf(llr[i]*scale);
+            v = min(max(v, -float(LLR_INT8_MAX)), float(LLR_INT8_MAX));
+            out[i] = (int8_t) v;
+        }
+    }
+
+    /**
+     * @brief Max-log soft demapper with int8 output.
+     *
+     * Symbols are demapped in blocks of DEMAP_BLOCK_SYMBOLS into a stack buffer and quantized.
+     *
+     * @param llr_scale: factor applied to the float LLRs before quantization.
+     */
+    inline void soft_demap_maxlog(const complex<float> * y, size_t n, const qammod_t & mod, float noise_var, float llr_scale, int8_t * llr)
+    {
+        alignas(64) float block[DEMAP_BLOCK_SYMBOLS*QAM256];
+        for (size_t i=0; i<n; i+=DEMAP_BLOCK_SYMBOLS){
+            size_t len = min((size_t) DEMAP_BLOCK_SYMBOLS, n-i);
+            soft_demap_maxlog(y+i, len, mod, noise_var, block);
+            quantize_llr(block, len*mod, llr_scale, llr + i*mod);
+        }
+    }
+
+    /**
+     * @brief Max-log soft demapper using one noise variance per resource block.
+     *
+     * Symbols are in data_idx order (see: demap_from_grid()), which is neither RB after RB nor the same
+     * number of symbols per RB, so the RB of every symbol is taken from the RB runs of the grid map.
+     *
+     * @param symbols: received symbols of the allocation, in data_idx order.
+     * @param mod: QAM modulation (QPSK, QAM16, QAM64 or QAM256).
+     * @param noise_var: noise variance per RB of the allocation (see: snr_to_noise_var(),
+     * channel_estimate_t::noise_var). The last value is reused for extra RBs.
+     * @param rb_runs: RB runs covering the symbols (see: grid_map_t::data_rb_runs).
+     * @param llr: vector where symbols.size()*mod float LLRs will be stored.
+     */
+    inline void soft_demap_maxlog(
+        const vector<complex<float>> & symbols,
+        const qammod_t & mod,
+        const vector<float> & noise_var,
+        const vector<grid_rb_run_t> & rb_runs,
+        vector<float> & llr)
+    {
+        const size_t n = symbols.size();
+        llr.resize(n*mod);
+        if (n==0 || noise_var.empty()){return;}
+        for (const auto & run : rb_runs){
+            assert(run.first + run.length <= n);
+            float nv = noise_var[min<size_t>(run.rb, noise_var.size()-1)];
+            soft_demap_maxlog(symbols.data()+run.first, run.length, mod, nv, llr.data() + run.first*mod);
+        }
+    }
+
+    /**
+     * @brief Max-log soft demapper using one noise variance per resource block, with int8 output.
+     * @param llr_scale: factor applied to the float LLRs before quantization.
+     */
+    inline void soft_demap_maxlog(
+        const vector<complex<float>> & symbols,
+        const qammod_t & mod,
+        const vector<float> & noise_var,
+        const vector<grid_rb_run_t> & rb_runs,
+        float llr_scale,
+        vector<int8_t> & llr)
+    {
+        const size_t n = symbols.size();
+        llr.resize(n*mod);
+        if (n==0 || noise_var.empty()){return;}
+        for (const auto & run : rb_runs){
+            assert(run.first + run.length <= n);
+            float nv = noise_var[min<size_t>(run.rb, noise_var.size()-1)];
+            soft_demap_maxlog(symbols.data()+run.first, run.length, mod, nv, llr_scale, llr.data() + run.first*mod);
+        }
+    }
+
+} /* namespace lib5grange */
+#endif /* INCLUDED_LIB5GRANGE_SOFT_DEMAPPER_H */
@@ -0,0 +1,149 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_LIB5GRANGE_WORK_STEALING_POOL_H
+#define INCLUDED_LIB5GRANGE_WORK_STEALING_POOL_H
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+namespace lib5grange {
+    using namespace std;
+
+    /**
+     * @brief Small fixed-size thread pool with one task deque per worker.
+     *
+     * Workers pop their own tasks from the back and steal from the front of the other deques when idle.
+     * parallel_for() spreads its iterations round-robin over the deques and the calling thread helps
+     * (stealing) until all of them are done, so it can also be used with zero workers. A task is a plain
+     * (body, counter, iteration) triple, so queuing an iteration does not build a std::function.
+     */
+    class WorkStealingPool {
+        private:
+            typedef struct {
+                const function<void(size_t)> * fn;  /**< Iteration body **/
+                atomic<size_t> * remaining;         /**< Iterations of the parallel_for() not yet done **/
+                size_t i;                           /**< Iteration **/
+            } task_t;
+
+            typedef struct {
+                mutex mtx;
+                deque<task_t> tasks;
+            } worker_queue_t;
+
+            vector<unique_ptr<worker_queue_t>> queues_;
+            vector<thread> threads_;
+            atomic<bool> stop_ {false};
+            atomic<size_t> pending_ {0};
+            mutex wake_mtx_;
+            condition_variable wake_cv_;
+
+            bool pop_task(size_t q, bool back, task_t & task){
+                worker_queue_t & wq = *queues_[q];
+                lock_guard<mutex> lock(wq.mtx);
+                if (wq.tasks.empty()){return false;}
+                if (back){
+                    task = wq.tasks.back();
+                    wq.tasks.pop_back();
+                }
+                else{
+                    task = wq.tasks.front();
+                    wq.tasks.pop_front();
+                }
+                pending_--;
+                return true;
+            }
+
+            /** Runs one task: own deque first (self < number of queues), then steals **/
+            bool run_one(size_t self){
+                task_t task;
+                const size_t nq = queues_.size();
+                bool found = (self < nq) && pop_task(self, true, task);
+                for (size_t i=1; !found && i<=nq; i++){
+                    found = pop_task((self + i) % nq, false, task);
+                }
+                if (found){
+                    (*task.fn)(task.i);
+                    (*task.remaining)--;    // Last access: the caller may return as soon as it reads zero
+                }
+                return found;
+            }
+
+            void worker_loop(size_t self){
+                while (!stop_){
+                    if (run_one(self)){continue;}
+                    unique_lock<mutex> lock(wake_mtx_);
+                    wake_cv_.wait(lock, [this](){return stop_ || pending_ > 0;});
+                }
+            }
+
+        public:
+            /**
+             * @brief Construct a new WorkStealingPool object
+             * @param num_threads: number of worker threads (the caller of parallel_for() also works).
+             */
+            WorkStealingPool(unsigned num_threads){
+                const size_t nq = num_threads > 0 ? num_threads : 1;
+                for (size_t i=0; i<nq; i++){
+                    queues_.emplace_back(new worker_queue_t());
+                }
+                for (unsigned i=0; i<num_threads; i++){
+                    threads_.emplace_back(&WorkStealingPool::worker_loop, this, i);
+                }
+            }
+
+            /** @brief Stops and joins the workers **/
+            ~WorkStealingPool(){
+                {
+                    lock_guard<mutex> lock(wake_mtx_);
+                    stop_ = true;
+                }
+                wake_cv_.notify_all();
+                for (auto & t : threads_){t.join();}
+            }
+
+            /** @brief Number of worker threads **/
+            size_t size() const {return threads_.size();}
+
+            /**
+             * @brief Runs fn(i) for i in [0, count) and returns when all calls are done.
+             * @param count: number of iterations.
+             * @param fn: iteration body, called concurrently from several threads.
+             */
+            void parallel_for(size_t count, const function<void(size_t)> & fn){
+                if (count == 0){return;}
+                if (threads_.empty() || count == 1){
+                    for (size_t i=0; i<count; i++){fn(i);}
+                    return;
+                }
+                atomic<size_t> remaining(count);
+                for (size_t i=0; i<count; i++){
+                    worker_queue_t & wq = *queues_[i % queues_.size()];
+                    lock_guard<mutex> lock(wq.mtx);
+                    wq.tasks.push_back(task_t{&fn, &remaining, i});
+                    pending_++;
+                }
+                {
+                    lock_guard<mutex> lock(wake_mtx_);
+                }
+                wake_cv_.notify_all();
+                while (remaining > 0){
+                    if (!run_one(queues_.size())){
+                        this_thread::yield();
+                    }
+                }
+            }
+    }; /* class WorkStealingPool */
+
+} /* namespace lib5grange */
+#endif /* INCLUDED_LIB5GRANGE_WORK_STEALING_POOL_H */
@@ -0,0 +1,278 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_CSI_STORE_H
+#define INCLUDED_CSI_STORE_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "libMac5gRange.h"
+
+/** Floats per UE row of the SNR matrix (MAX_NUM_RB rounded up to whole 64-byte lines) **/
+#define CSI_ROW_STRIDE (((MAX_NUM_RB+15)/16)*16)
+
+/** Default number of UEs (target_ue_id is 8 bits wide) **/
+#define CSI_DEFAULT_MAX_UES 256
+
+/** Default EWMA weight of a new report **/
+#define CSI_DEFAULT_ALPHA 0.25f
+
+/** Number of entries of mappingSNRtoMCS **/
+#define CSI_NUM_MCS_THRESHOLDS (sizeof(mappingSNRtoMCS)/sizeof(mappingSNRtoMCS[0]))
+
+/** Age of a UE (or RB) that never received a report **/
+#define CSI_NEVER_REPORTED (~0u)
+
+/**
+ * @brief Channel state database of the UEs, indexed by target_ue_id.
+ *
+ * The filtered SNR per RB (dB) of all UEs is one contiguous, 64-byte aligned [UE][CSI_ROW_STRIDE] float
+ * matrix, updated with an exponentially weighted moving average (f += alpha*(snr-f)) as RxMetrics reports
+ * arrive; the subframe of the last report of each RB is kept in a matrix of the same shape. Derived values
+ * (wideband average, best RB window, MCS per RB from mappingSNRtoMCS) are computed when first asked for
+ * after a report and cached until the next one. Not thread safe: meant to be owned by the scheduler thread.
+ */
+class CsiStore{
+    private:
+        unsigned maxUEs_;
+        float alpha_;
+        float * snr_ = nullptr;                 //[UE][CSI_ROW_STRIDE] filtered SNR (dB)
+        uint32_t * lastReport_ = nullptr;       //[UE][CSI_ROW_STRIDE] subframe of the last report of each RB
+        uint8_t * mcs_ = nullptr;               //[UE][CSI_ROW_STRIDE] cached MCS per RB
+        vector<uint8_t> reported_;              //UE received at least one report
+        vector<uint8_t> dirty_;                 //Derived values out of date
+        vector<uint32_t> ueLastReport_;         //Subframe of the last report of each UE
+        vector<float> wideband_;                //Cached wideband average (dB)
+        vector<uint16_t> windowSize_;           //Window size of the cached best window (0: none)
+        vector<uint16_t> windowFirst_;          //Cached best window first RB
+
+        template <typename T>
+        static T * allocate(size_t count){
+            void * p = aligned_alloc(64, ((count*sizeof(T)+63)/64)*64);
+            if(p==NULL) perror("Error allocating CSI store");
+            else memset(p, 0, count*sizeof(T));
+            return (T *) p;
+        }
+
+        float * row(unsigned ue){
+            return snr_ + size_t(ue)*CSI_ROW_STRIDE;
+        }
+
+        /** EWMA update of a range of RBs (vectorized where AVX2 is available) **/
+        void filter(float * f, uint32_t * age, const float * snr, size_t numRB, unsigned subframe){
+            size_t i = 0;
+#if defined(__AVX2__)
+            const __m256 va = _mm256_set1_ps(alpha_);
+            const __m256i vs = _mm256_set1_epi32(subframe);
+            for(;i+8<=numRB;i+=8){
+                __m256 vf = _mm256_loadu_ps(f+i);
+                __m256 vx = _mm256_loadu_ps(snr+i);
+                _mm256_storeu_ps(f+i, _mm256_add_ps(vf, _mm256_mul_ps(va, _mm256_sub_ps(vx, vf))));
+                _mm256_storeu_si256((__m256i *) (age+i), vs);
+            }
+#endif
+            for(;i<numRB;i++){
+                f[i] += alpha_*(snr[i]-f[i]);
+                age[i] = subframe;
+            }
+        }
+
+        /** Recomputes the MCS per RB and the wideband average of a UE **/
+        void refresh(unsigned ue){
+            const float * f = row(ue);
+            uint8_t * m = mcs_ + size_t(ue)*CSI_ROW_STRIDE;
+            size_t rb = 0;
+            float sum = 0;
+#if defined(__AVX2__)
+            __m256 vsum = _mm256_setzero_ps();
+            for(;rb+8<=MAX_NUM_RB;rb+=8){
+                __m256 vf = _mm256_loadu_ps(f+rb);
+                vsum = _mm256_add_ps(vsum, vf);
+                //MCS = number of thresholds at or below the SNR
+                __m256i count = _mm256_setzero_si256();
+                for(size_t t=0;t<CSI_NUM_MCS_THRESHOLDS;t++){
+                    __m256 ge = _mm256_cmp_ps(vf, _mm256_set1_ps(mappingSNRtoMCS[t]), _CMP_GE_OQ);
+                    count = _mm256_sub_epi32(count, _mm256_castps_si256(ge));
+                }
+                alignas(32) int32_t c[8];
+                _mm256_store_si256((__m256i *) c, count);
+                for(int k=0;k<8;k++) m[rb+k] = c[k];
+            }
+            alignas(32) float s[8];
+            _mm256_store_ps(s, vsum);
+            for(int k=0;k<8;k++) sum += s[k];
+#endif
+            for(;rb<MAX_NUM_RB;rb++){
+                sum += f[rb];
+                uint8_t count = 0;
+                for(size_t t=0;t<CSI_NUM_MCS_THRESHOLDS;t++) count += f[rb]>=mappingSNRtoMCS[t];
+                m[rb] = count;
+            }
+            wideband_[ue] = sum/MAX_NUM_RB;
+            windowSize_[ue] = 0;
+            dirty_[ue] = 0;
+        }
+
+    public:
+        /**
+         * @brief Construct a new CsiStore object
+         * @param maxUEs: number of UE ids (target_ue_id must be below it)
+         * @param alpha: EWMA weight of a new report (1: keep only the last report)
+         */
+        CsiStore(unsigned maxUEs = CSI_DEFAULT_MAX_UES, float alpha = CSI_DEFAULT_ALPHA){
+            maxUEs_ = maxUEs;
+            alpha_ = alpha;
+            snr_ = allocate<float>(size_t(maxUEs)*CSI_ROW_STRIDE);
+            lastReport_ = allocate<uint32_t>(size_t(maxUEs)*CSI_ROW_STRIDE);
+            mcs_ = allocate<uint8_t>(size_t(maxUEs)*CSI_ROW_STRIDE);
+            reported_.assign(maxUEs, 0);
+            dirty_.assign(maxUEs, 1);
+            ueLastReport_.assign(maxUEs, 0);
+            wideband_.assign(maxUEs, 0);
+            windowSize_.assign(maxUEs, 0);
+            windowFirst_.assign(maxUEs, 0);
+        }
+
+        CsiStore(const CsiStore &) = delete;
+        CsiStore & operator=(const CsiStore &) = delete;
+
+        /** @brief Frees the matrices **/
+        ~CsiStore(){
+            free(snr_);
+            free(lastReport_);
+            free(mcs_);
+        }
+
+        /**
+         * @brief Applies a SNR report to a UE
+         * The first report of a UE (or after clear()) is taken as is, later ones are filtered.
+         * @param ue: target_ue_id
+         * @param snr: SNR per RB (dB), starting at firstRB
+         * @param numRB: number of reported RBs
+         * @param subframe: subframe of the report
+         * @param firstRB: first reported RB
+         */
+        void update(uint8_t ue, const float * snr, size_t numRB, unsigned subframe, size_t firstRB = 0){
+            if(ue>=maxUEs_ || firstRB>=MAX_NUM_RB) return;
+            if(firstRB+numRB>MAX_NUM_RB) numRB = MAX_NUM_RB-firstRB;
+            float * f = row(ue);
+            uint32_t * age = lastReport_ + size_t(ue)*CSI_ROW_STRIDE;
+            if(!reported_[ue]){
+                //Unreported RBs start at the first reported value
+                float initial = numRB>0 ? snr[0] : 0;
+                for(size_t i=0;i<MAX_NUM_RB;i++){
+                    f[i] = initial;
+                    age[i] = CSI_NEVER_REPORTED;
+                }
+                memcpy(f+firstRB, snr, numRB*sizeof(float));
+                for(size_t i=firstRB;i<firstRB+numRB;i++) age[i] = subframe;
+                reported_[ue] = 1;
+            }
+            else filter(f+firstRB, age+firstRB, snr, numRB, subframe);
+            ueLastReport_[ue] = subframe;
+            dirty_[ue] = 1;
+        }
+
+        /**
+         * @brief Applies a RxMetrics report (RxMetrics::snr, from RB 0) to a UE
+         */
+        void update(uint8_t ue, const RxMetrics & metrics, unsigned subframe){
+            update(ue, metrics.snr.data(), metrics.snr.size(), subframe);
+        }
+
+        /** @brief Forgets the reports of a UE **/
+        void clear(uint8_t ue){
+            if(ue>=maxUEs_) return;
+            reported_[ue] = 0;
+            dirty_[ue] = 1;
+        }
+
+        /** @brief True if the UE has received at least one report **/
+        bool hasReport(uint8_t ue) const{
+            return ue<maxUEs_ && reported_[ue];
+        }
+
+        /**
+         * @brief Number of subframes since the last report of a UE (CSI_NEVER_REPORTED if none)
+         * @param ue: target_ue_id
+         * @param subframe: current subframe
+         * @param rb: RB whose age is wanted, or -1 for the last report of any RB (CSI_NEVER_REPORTED if out of range)
+         */
+        unsigned age(uint8_t ue, unsigned subframe, int rb = -1) const{
+            if(!hasReport(ue) || rb>=int(MAX_NUM_RB)) return CSI_NEVER_REPORTED;
+            uint32_t last = rb<0 ? ueLastReport_[ue] : lastReport_[size_t(ue)*CSI_ROW_STRIDE+rb];
+            if(last==CSI_NEVER_REPORTED) return CSI_NEVER_REPORTED;
+            return subframe-last;
+        }
+
+        /** @brief Filtered SNR per RB (dB) of a UE: MAX_NUM_RB values, 64-byte aligned (NULL if ue is out of range) **/
+        const float * snr(uint8_t ue) const{
+            if(ue>=maxUEs_) return NULL;
+            return snr_ + size_t(ue)*CSI_ROW_STRIDE;
+        }
+
+        /** @brief Wideband average of the filtered SNR (dB), 0 if ue is out of range **/
+        float widebandSnr(uint8_t ue){
+            if(ue>=maxUEs_) return 0;
+            if(dirty_[ue]) refresh(ue);
+            return wideband_[ue];
+        }
+
+        /** @brief MCS per RB (see: mappingSNRtoMCS): MAX_NUM_RB values (NULL if ue is out of range) **/
+        const uint8_t * mcs(uint8_t ue){
+            if(ue>=maxUEs_) return NULL;
+            if(dirty_[ue]) refresh(ue);
+            return mcs_ + size_t(ue)*CSI_ROW_STRIDE;
+        }
+
+        /** @brief MCS of a wideband allocation **/
+        uint8_t widebandMcs(uint8_t ue){
+            float w = widebandSnr(ue);
+            uint8_t count = 0;
+            for(size_t t=0;t<CSI_NUM_MCS_THRESHOLDS;t++) count += w>=mappingSNRtoMCS[t];
+            return count;
+        }
+
+        /**
+         * @brief First RB of the window of contiguous RBs with the highest average filtered SNR
+         * The result for the last asked window size is cached until the next report.
+         * @param ue: target_ue_id
+         * @param numRB: window size (1 - MAX_NUM_RB)
+         * @return first RB of the window, 0 if ue is out of range
+         */
+        unsigned bestWindow(uint8_t ue, unsigned numRB){
+            if(ue>=maxUEs_) return 0;
+            if(numRB==0 || numRB>MAX_NUM_RB) numRB = MAX_NUM_RB;
+            if(dirty_[ue]) refresh(ue);
+            if(windowSize_[ue]==numRB) return windowFirst_[ue];
+            const float * f = row(ue);
+            float sum = 0;
+            for(unsigned i=0;i<numRB;i++) sum += f[i];
+            float best = sum;
+            unsigned first = 0;
+            for(unsigned i=numRB;i<MAX_NUM_RB;i++){
+                sum += f[i]-f[i-numRB];
+                if(sum>best){
+                    best = sum;
+                    first = i-numRB+1;
+                }
+            }
+            windowSize_[ue] = numRB;
+            windowFirst_[ue] = first;
+            return first;
+        }
+
+        /** @brief Number of UE ids **/
+        unsigned maxUEs() const{
+            return maxUEs_;
+        }
+};
+#endif  //INCLUDED_CSI_STORE_H
@@ -8,9 +8,14 @@
 #define INCLUDED_LIB_MAC_5G_RANGE_H
 
 #include <cstdint>
+#include <cstring>
 #include <vector>
 #include "../lib5grange/lib5grange.h"
 #include <mutex>
+#include <memory>
+#include <cstdio>
+#include <cerrno>
+#include <time.h>
 #include <mqueue.h>
 #include <sys/resource.h>
 
@@ -22,6 +27,21 @@
 #define MQ_MAX_NUM_MSG 100
 #define MQ_MAX_MSG_SIZE 204800
 
+/** Largest queue name length (MQ_* name plus the cell suffix) **/
+#define MQ_NAME_MAX_LEN 64
+
+/** mq priorities. Control messages and PDUs use separate queues, so control precedence comes from the
+ *  reader serving the control queue first; within a queue every message is sent with MQ_PRIORITY_NORMAL
+ *  (FIFO), and MQ_PRIORITY_REQUEUED only puts a fresh PDU back at the head after a drop-oldest check **/
+#define MQ_PRIORITY_NORMAL 0
+#define MQ_PRIORITY_REQUEUED 1
+
+/** Messages evicted at most by one drop-oldest send **/
+#define MQ_MAX_EVICTIONS 4
+
+/** Offset of macphy_ctl_.subframe_number in a serialized MacPDU (after numID_ and sequence_number) **/
+#define MQ_PDU_SUBFRAME_OFFSET (sizeof(unsigned) + sizeof(uint8_t))
+
 using namespace std;
 using namespace lib5grange;
 
@@ -207,25 +227,75 @@ typedef struct{
 }RxMetrics;
 
 
+/** Queues of a MAC/PHY link **/
+enum L1L2Queues {PDU_TO_PHY, PDU_FROM_PHY, CONTROL_TO_PHY, CONTROL_FROM_PHY, NUM_L1L2_QUEUES};
+
+/**
+ * @brief Behaviour of a send on a full queue
+ */
+enum L1L2SendPolicies {
+    SEND_BLOCKING,      //Wait until there is room (mq_send)
+    SEND_REJECT_NEW,    //Drop the new message
+    SEND_DROP_OLDEST,   //Evict the oldest PDUs if they are past their subframe (PDU queues only)
+    SEND_TIMED_WAIT     //Wait up to a timeout, then drop the new message (mq_timedsend)
+};
+
+/** Reasons why a message was dropped on send **/
+enum L1L2DropReasons {DROP_REJECTED, DROP_EVICTED, DROP_TIMEOUT, NUM_DROP_REASONS};
+
+/**
+ * @brief Per queue statistics of a MAC/PHY link
+ * Each counter is updated by the thread using the queue on this side of the link.
+ */
+typedef struct{
+    uint64_t messagesSent[NUM_L1L2_QUEUES];     //Messages sent on each queue
+    uint64_t bytesSent[NUM_L1L2_QUEUES];        //Bytes sent on each queue
+    uint64_t messagesReceived[NUM_L1L2_QUEUES]; //Messages received from each queue
+    uint64_t bytesReceived[NUM_L1L2_QUEUES];    //Bytes received from each queue
+    uint64_t errors[NUM_L1L2_QUEUES];           //Failed mq_send/mq_receive calls on each queue
+    uint64_t drops[NUM_L1L2_QUEUES][NUM_DROP_REASONS];  //Messages dropped on send, by reason
+}l1_l2_stats_t;
+
 /**
  * @brief Struct for Message Queues used to interface MAC and PHY
+ * Several links (one per cell/sector) can live on the same host: createMessageQueues(cellId) appends
+ * the cell id to the queue names, while createMessageQueues() keeps the MQ_* names of a single link.
  */
 typedef struct{
     mqd_t mqPduToPhy;                       //Message Queue descriptor used to RECEIVE PDUs from L2
     mqd_t mqPduFromPhy;                     //Message Queue descriptor used to SEND PDUs to L2
     mqd_t mqControlToPhy;                   //Message Queue descriptor used to RECEIVE Control Messages from L2
     mqd_t mqControlFromPhy;                 //Message Queue descriptor used to SEND Control Messages to L2
+    int cellId = -1;                        //Cell/sector id of the link (-1: single link, MQ_* names)
+    char queueNames[NUM_L1L2_QUEUES][MQ_NAME_MAX_LEN] = {};    //Names of the queues
+    l1_l2_stats_t stats = {};               //Statistics of this side of the link
+    L1L2SendPolicies sendPolicy[NUM_L1L2_QUEUES] = {};     //Policy of each queue on full (SEND_BLOCKING)
+    uint64_t sendTimeoutNs[NUM_L1L2_QUEUES] = {};           //Timeout of SEND_TIMED_WAIT
 
     /**
      * @brief Procedure to create all 4 queues to communicate MAC and PHY
      */
     void createMessageQueues(){
+        createMessageQueues(-1);
+    }
+
+    /**
+     * @brief Procedure to create the 4 queues of the link of a cell
+     * @param cell: cell/sector id, appended to the queue names (-1 for the MQ_* names)
+     */
+    void createMessageQueues(int cell){
+        cellId = cell;
+        for(int q=0;q<NUM_L1L2_QUEUES;q++){
+            if(cell<0) snprintf(queueNames[q], MQ_NAME_MAX_LEN, "%s", defaultQueueName(q));
+            else snprintf(queueNames[q], MQ_NAME_MAX_LEN, "%s_cell%d", defaultQueueName(q), cell);
+        }
+        memset(&stats, 0, sizeof(stats));
+
         //Increase System limits according to https://linux.die.net/man/2/setrlimit
-        struct rlimit rlim;
-        memset(&rlim, 0, sizeof(rlim));
-        rlim.rlim_cur = 5*(MQ_MAX_NUM_MSG*MQ_MAX_MSG_SIZE + MQ_MAX_NUM_MSG*sizeof(struct msg_msg *));
-        rlim.rlim_max = 5*(MQ_MAX_NUM_MSG*MQ_MAX_MSG_SIZE + MQ_MAX_NUM_MSG*sizeof(struct msg_msg *));
-        setrlimit(RLIMIT_MSGQUEUE, &rlim); 
+        //RLIMIT_MSGQUEUE is accounted per user, so it must cover every link of the host
+        unsigned links = registerLink(1);
+        if(cell+1>(int)links) links = cell+1;
+        reserveLinks(links);
 
         //Define message queue attributes
         struct mq_attr messageQueueAttributes;
@@ -233,22 +303,22 @@ typedef struct{
         messageQueueAttributes.mq_msgsize = MQ_MAX_MSG_SIZE;
 
         //Open PDU message queues (PDU queues are non-blockable)
-        mqPduToPhy = mq_open( MQ_PDU_TO_L1, \
+        mqPduToPhy = mq_open( queueNames[PDU_TO_PHY], \
                                 O_CREAT|O_RDWR, \
                                 0666, \
                                 &messageQueueAttributes);
-        mqPduFromPhy = mq_open( MQ_PDU_FROM_L1, \
+        mqPduFromPhy = mq_open( queueNames[PDU_FROM_PHY], \
                                 O_CREAT|O_RDWR, \
                                 0666, \
                                 &messageQueueAttributes);   
     
         
         //Open Control message queues
-        mqControlToPhy = mq_open( MQ_CONTROL_TO_L1, \
+        mqControlToPhy = mq_open( queueNames[CONTROL_TO_PHY], \
                                 O_CREAT|O_RDWR, \
                                 0666, \
                                 &messageQueueAttributes);
-        mqControlFromPhy = mq_open( MQ_CONTROL_FROM_L1, \
+        mqControlFromPhy = mq_open( queueNames[CONTROL_FROM_PHY], \
                                 O_CREAT|O_RDWR, \
                                 0666, \
                                 &messageQueueAttributes);   
@@ -272,6 +342,191 @@ typedef struct{
         clearQueue(mqControlFromPhy);
     }
 
+    /** @brief MQ_* name of a queue **/
+    static const char * defaultQueueName(int queue){
+        switch(queue){
+            case PDU_TO_PHY: return MQ_PDU_TO_L1;
+            case PDU_FROM_PHY: return MQ_PDU_FROM_L1;
+            case CONTROL_TO_PHY: return MQ_CONTROL_TO_L1;
+            default: return MQ_CONTROL_FROM_L1;
+        }
+    }
+
+    /**
+     * @brief Counts the links created (or closed) in this process
+     * @param delta: +1 on creation, -1 on close
+     * @return number of links of the process
+     */
+    static unsigned registerLink(int delta){
+        static mutex linksMutex;
+        static unsigned links = 0;
+        lock_guard<mutex> lock(linksMutex);
+        if(delta<0 && links>0) links--;
+        else if(delta>0) links++;
+        return links;
+    }
+
+    /**
+     * @brief Raises RLIMIT_MSGQUEUE to fit a number of links (it is never lowered)
+     * Call it before creating the first link when the other links of the host live in other processes.
+     * @param links: number of links sharing the limit
+     * @return false if the limit could not be raised
+     */
+    static bool reserveLinks(unsigned links){
+        rlim_t perQueue = MQ_MAX_NUM_MSG*MQ_MAX_MSG_SIZE + MQ_MAX_NUM_MSG*sizeof(struct msg_msg *);
+        rlim_t needed = 5*perQueue;     //One link plus one queue of headroom
+        if(links>1) needed = (rlim_t(links)*NUM_L1L2_QUEUES + 1)*perQueue;
+        struct rlimit rlim;
+        memset(&rlim, 0, sizeof(rlim));
+        getrlimit(RLIMIT_MSGQUEUE, &rlim);
+        if(rlim.rlim_cur==RLIM_INFINITY || rlim.rlim_cur>=needed) return true;
+        rlim.rlim_cur = needed;
+        if(rlim.rlim_max!=RLIM_INFINITY && rlim.rlim_max<needed) rlim.rlim_max = needed;
+        return setrlimit(RLIMIT_MSGQUEUE, &rlim)==0;
+    }
+
+    /** @brief Descriptor of a queue **/
+    mqd_t descriptor(L1L2Queues queue) const{
+        switch(queue){
+            case PDU_TO_PHY: return mqPduToPhy;
+            case PDU_FROM_PHY: return mqPduFromPhy;
+            case CONTROL_TO_PHY: return mqControlToPhy;
+            default: return mqControlFromPhy;
+        }
+    }
+
+    /**
+     * @brief Selects what a send does when a queue is full
+     * @param queue: queue of the link
+     * @param policy: send policy
+     * @param timeoutNs: wait limit of SEND_TIMED_WAIT
+     */
+    void setSendPolicy(L1L2Queues queue, L1L2SendPolicies policy, uint64_t timeoutNs = 0){
+        sendPolicy[queue] = policy;
+        sendTimeoutNs[queue] = timeoutNs;
+    }
+
+    /** @brief True for the queues carrying serialized MacPDUs **/
+    static bool isPduQueue(L1L2Queues queue){
+        return queue==PDU_TO_PHY || queue==PDU_FROM_PHY;
+    }
+
+    /**
+     * @brief Reads macphy_ctl_.subframe_number from a serialized MacPDU (see: MacPDU::serialize())
+     * @return false if the message is too short to be a PDU
+     */
+    static bool pduSubframe(const char * data, size_t size, unsigned & subframe){
+        if(size<MQ_PDU_SUBFRAME_OFFSET+sizeof(unsigned)) return false;
+        memcpy(&subframe, data+MQ_PDU_SUBFRAME_OFFSET, sizeof(unsigned));
+        return true;
+    }
+
+    /**
+     * @brief Sends a message on a queue following its send policy, updating the statistics
+     *
+     * SEND_DROP_OLDEST evicts, one at a time, head PDUs whose subframe is before currentSubframe. The head
+     * has to be received to be inspected: if it is not stale it is put back at the head (MQ_PRIORITY_REQUEUED,
+     * so the delivery order is kept) and the new message is rejected. Every evicted or lost message is counted
+     * as DROP_EVICTED. Control queues are never evicted: there SEND_DROP_OLDEST behaves as SEND_REJECT_NEW.
+     * Each queue must have a single sender on this side of the link.
+     * @param queue: queue of the link
+     * @param bytes: serialized message
+     * @param currentSubframe: subframe being prepared; PDUs of earlier subframes are stale (SEND_DROP_OLDEST)
+     * @return false if the message was dropped or on error
+     */
+    bool send(L1L2Queues queue, const vector<uint8_t> & bytes, unsigned currentSubframe = 0){
+        const mqd_t mq = descriptor(queue);
+        const char * data = (const char *) bytes.data();
+        const timespec immediate = {0, 0};      //Absolute time in the past: never waits
+        int result;
+        switch(sendPolicy[queue]){
+            case SEND_REJECT_NEW:
+                result = mq_timedsend(mq, data, bytes.size(), MQ_PRIORITY_NORMAL, &immediate);
+                if(result==-1 && errno==ETIMEDOUT){
+                    stats.drops[queue][DROP_REJECTED]++;
+                    return false;
+                }
+                break;
+            case SEND_DROP_OLDEST:
+                result = mq_timedsend(mq, data, bytes.size(), MQ_PRIORITY_NORMAL, &immediate);
+                for(int i=0;isPduQueue(queue) && i<MQ_MAX_EVICTIONS && result==-1 && errno==ETIMEDOUT;i++){
+                    thread_local vector<char> evicted(MQ_MAX_MSG_SIZE);
+                    unsigned evictedPriority, subframe;
+                    ssize_t size = mq_timedreceive(mq, evicted.data(), MQ_MAX_MSG_SIZE, &evictedPriority, &immediate);
+                    if(size==-1){
+                        //Emptied by the reader meanwhile: retry the send
+                        result = mq_timedsend(mq, data, bytes.size(), MQ_PRIORITY_NORMAL, &immediate);
+                        continue;
+                    }
+                    if(pduSubframe(evicted.data(), size, subframe) && int32_t(subframe-currentSubframe)>=0){
+                        //Oldest PDU still current: no PDU is stale
+                        if(mq_timedsend(mq, evicted.data(), size, MQ_PRIORITY_REQUEUED, &immediate)==-1)
+                            stats.drops[queue][DROP_EVICTED]++;
+                        errno = ETIMEDOUT;
+                        break;
+                    }
+                    stats.drops[queue][DROP_EVICTED]++;
+                    result = mq_timedsend(mq, data, bytes.size(), MQ_PRIORITY_NORMAL, &immediate);
+                }
+                if(result==-1 && errno==ETIMEDOUT){
+                    stats.drops[queue][DROP_REJECTED]++;
+                    return false;
+                }
+                break;
+            case SEND_TIMED_WAIT:{
+                timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                uint64_t ns = deadline.tv_nsec + sendTimeoutNs[queue];
+                deadline.tv_sec += ns/1000000000ULL;
+                deadline.tv_nsec = ns%1000000000ULL;
+                result = mq_timedsend(mq, data, bytes.size(), MQ_PRIORITY_NORMAL, &deadline);
+                if(result==-1 && errno==ETIMEDOUT){
+                    stats.drops[queue][DROP_TIMEOUT]++;
+                    return false;
+                }
+                break;
+            }
+            default:
+                result = mq_send(mq, data, bytes.size(), MQ_PRIORITY_NORMAL);
+        }
+        if(result==-1){
+            stats.errors[queue]++;
+            return false;
+        }
+        stats.messagesSent[queue]++;
+        stats.bytesSent[queue] += bytes.size();
+        return true;
+    }
+
+    /** @brief Messages dropped on send on a queue (all reasons) **/
+    uint64_t drops(L1L2Queues queue) const{
+        uint64_t total = 0;
+        for(int r=0;r<NUM_DROP_REASONS;r++) total += stats.drops[queue][r];
+        return total;
+    }
+
+    /**
+     * @brief Receives a message from a queue, updating the statistics
+     * @param queue: queue of the link
+     * The message lands in a per-thread MQ_MAX_MSG_SIZE buffer allocated once (not zero filled), and only
+     * its actual size is copied into bytes.
+     * @param bytes: vector where the message is stored (resized to the message size)
+     * @return false on error
+     */
+    bool receive(L1L2Queues queue, vector<uint8_t> & bytes){
+        thread_local unique_ptr<char[]> buffer(new char[MQ_MAX_MSG_SIZE]);
+        ssize_t size = mq_receive(descriptor(queue), buffer.get(), MQ_MAX_MSG_SIZE, NULL);
+        if(size==-1){
+            stats.errors[queue]++;
+            bytes.clear();
+            return false;
+        }
+        bytes.assign(buffer.get(), buffer.get()+size);
+        stats.messagesReceived[queue]++;
+        stats.bytesReceived[queue] += size;
+        return true;
+    }
+
     /**
      * @brief This procedure clears the queue when it is being opened
      * @param mQueue
@@ -280,7 +535,8 @@ typedef struct{
         struct mq_attr mQueueAttributes;    //Struct to store current messageQueue's number of messages
         char buffer[MQ_MAX_MSG_SIZE];   //Buffer to store provisional message
         //Get attributes
-        mq_getattr(mQueue, &mQueueAttributes);
+        if(mQueue==-1 || mq_getattr(mQueue, &mQueueAttributes)==-1)
+            return;
 
         //Repeat message reception
         for(int i=0;i<mQueueAttributes.mq_curmsgs;i++)
@@ -299,10 +555,9 @@ typedef struct{
         mq_close(mqControlFromPhy);
 
         //Unlink message queues
-        mq_unlink(MQ_PDU_TO_L1);
-        mq_unlink(MQ_PDU_FROM_L1);
-        mq_unlink(MQ_CONTROL_TO_L1);
-        mq_unlink(MQ_CONTROL_FROM_L1);
+        for(int q=0;q<NUM_L1L2_QUEUES;q++)
+            mq_unlink(queueNames[q][0]!=0 ? queueNames[q] : defaultQueueName(q));
+        registerLink(-1);
     }
 }l1_l2_interface_t;
 #endif  //INCLUDED_LIB_MAC_5G_RANGE_H
\ No newline at end of file
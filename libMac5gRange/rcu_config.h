@@ -0,0 +1,227 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_RCU_CONFIG_H
+#define INCLUDED_RCU_CONFIG_H
+
+#include <cstdint>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include "libMac5gRange.h"
+#include "spsc_queue.h"
+
+/** Largest number of threads reading the configuration **/
+#define RCU_MAX_READERS 32
+
+/** Reader slot value of a reader that is not registered or offline **/
+#define RCU_OFFLINE 0
+
+/**
+ * @brief Configuration that can change in RECONFIG_MODE
+ */
+typedef struct{
+    uint8_t numerology;             //Numerology to be used in downlink
+    uint8_t ofdm_gfdm;              //Data transmission technique (0=OFDM; 1=GFDM)
+    uint8_t fLutDL;                 //Fusion Spectrum Analysis LUT
+    uint8_t rxMetricPeriodicity;    //CSI periodicity for CQI, PMI, RI and SSM provided by PHY
+
+    /**
+     * @brief Copies the configuration into a BSSubframeTx.Start message
+     * @param message: message to be filled
+     */
+    void fill(BSSubframeTx_Start & message) const{
+        message.numerology = numerology;
+        message.ofdm_gfdm = ofdm_gfdm;
+        message.fLutDL = fLutDL;
+        message.rxMetricPeriodicity = rxMetricPeriodicity;
+    }
+}MacConfig;
+
+/**
+ * @brief Immutable, versioned configuration snapshot
+ */
+template <typename T>
+struct ConfigSnapshot{
+    T config;                                   //Configuration values
+    uint64_t version;                           //1 for the first snapshot, incremented on every publish
+    unsigned firstSubframe;                     //First subframe where the snapshot is valid
+    atomic<const ConfigSnapshot<T> *> previous; //Snapshot valid before firstSubframe
+};
+
+/**
+ * @brief Read-copy-update holder of a configuration.
+ *
+ * Writers publish a new immutable snapshot together with the subframe where it becomes valid; readers
+ * get the snapshot valid for the subframe they process with one acquire load of the newest snapshot
+ * (plus a walk to older ones only while a future switch is pending), so the change happens exactly at
+ * that subframe boundary in every thread and nobody takes a lock on the hot path.
+ * Old snapshots are reclaimed with quiescent-state epochs: each reader calls quiescent() at its subframe
+ * boundary, reporting the next subframe it will process, and a detached snapshot is freed once every
+ * online reader has reported a newer epoch.
+ */
+template <typename T>
+class RcuConfig{
+    private:
+        typedef struct{
+            alignas(CACHE_LINE_SIZE) atomic<uint64_t> epoch {RCU_OFFLINE};  //Last epoch seen at a quiescent point
+            atomic<unsigned> subframe {0};                                  //Next subframe the reader will process
+            atomic<bool> used {false};
+        }ReaderSlot;
+
+        typedef struct{
+            const ConfigSnapshot<T> * snapshot;
+            uint64_t epoch;
+        }RetiredSnapshot;
+
+        alignas(CACHE_LINE_SIZE) atomic<const ConfigSnapshot<T> *> head_;
+        alignas(CACHE_LINE_SIZE) atomic<uint64_t> epoch_ {1};
+        ReaderSlot readers_[RCU_MAX_READERS];
+        mutex writerMutex_;                         //Serializes writers only
+        vector<RetiredSnapshot> retired_;
+
+        static bool reached(unsigned subframe, unsigned first){
+            return int32_t(subframe-first) >= 0;
+        }
+
+        void freeRetired(){
+            uint64_t minEpoch = UINT64_MAX;
+            for(int i=0;i<RCU_MAX_READERS;i++){
+                uint64_t e = readers_[i].epoch.load(memory_order_acquire);
+                if(readers_[i].used.load(memory_order_acquire) && e!=RCU_OFFLINE && e<minEpoch) minEpoch = e;
+            }
+            size_t kept = 0;
+            for(size_t i=0;i<retired_.size();i++){
+                if(retired_[i].epoch <= minEpoch) delete retired_[i].snapshot;
+                else retired_[kept++] = retired_[i];
+            }
+            retired_.resize(kept);
+        }
+
+    public:
+        /**
+         * @brief Construct a new RcuConfig object
+         * @param initial: configuration valid from subframe 0
+         */
+        explicit RcuConfig(const T & initial){
+            head_.store(new ConfigSnapshot<T>{initial, 1, 0, {nullptr}}, memory_order_release);
+        }
+
+        /** @brief Frees all snapshots (no reader may be running) **/
+        ~RcuConfig(){
+            const ConfigSnapshot<T> * p = head_.load();
+            while(p!=nullptr){
+                const ConfigSnapshot<T> * previous = p->previous.load();
+                delete p;
+                p = previous;
+            }
+            for(auto & r : retired_) delete r.snapshot;
+        }
+
+        /**
+         * @brief Registers the calling reader thread
+         * Readers must register before the snapshot they start with is superseded (e.g. in START_MODE,
+         * before the first publish), since snapshots older than every registered reader are reclaimed.
+         * @param subframe: first subframe the reader will process
+         * @return reader id, or -1 if all RCU_MAX_READERS slots are used
+         */
+        int registerReader(unsigned subframe){
+            for(int i=0;i<RCU_MAX_READERS;i++){
+                bool expected = false;
+                if(readers_[i].used.compare_exchange_strong(expected, true)){
+                    readers_[i].subframe.store(subframe, memory_order_relaxed);
+                    readers_[i].epoch.store(epoch_.load(memory_order_acquire), memory_order_release);
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        /** @brief Releases a reader slot **/
+        void unregisterReader(int reader){
+            readers_[reader].epoch.store(RCU_OFFLINE, memory_order_release);
+            readers_[reader].used.store(false, memory_order_release);
+        }
+
+        /**
+         * @brief Hot path: snapshot valid for a subframe
+         * The pointer stays valid until the reader's next quiescent() call.
+         */
+        const ConfigSnapshot<T> * get(unsigned subframe) const{
+            const ConfigSnapshot<T> * p = head_.load(memory_order_acquire);
+            while(!reached(subframe, p->firstSubframe)){
+                const ConfigSnapshot<T> * previous = p->previous.load(memory_order_acquire);
+                if(previous==nullptr) break;
+                p = previous;
+            }
+            return p;
+        }
+
+        /**
+         * @brief Marks a quiescent point of a reader (subframe boundary): it holds no snapshot pointer anymore
+         * @param reader: reader id
+         * @param nextSubframe: next subframe the reader will process
+         */
+        void quiescent(int reader, unsigned nextSubframe){
+            readers_[reader].subframe.store(nextSubframe, memory_order_relaxed);
+            readers_[reader].epoch.store(epoch_.load(memory_order_acquire), memory_order_release);
+        }
+
+        /**
+         * @brief Publishes a new configuration (writer side, used in RECONFIG_MODE)
+         * @param config: new configuration
+         * @param firstSubframe: subframe boundary where the configuration becomes valid
+         * @return version of the new snapshot
+         */
+        uint64_t publish(const T & config, unsigned firstSubframe){
+            lock_guard<mutex> lock(writerMutex_);
+            const ConfigSnapshot<T> * current = head_.load(memory_order_acquire);
+            uint64_t version = current->version+1;
+            head_.store(new ConfigSnapshot<T>{config, version, firstSubframe, {current}}, memory_order_release);
+            reclaimLocked();
+            return version;
+        }
+
+        /** @brief Writer side: frees snapshots no reader can reach anymore **/
+        void reclaim(){
+            lock_guard<mutex> lock(writerMutex_);
+            reclaimLocked();
+        }
+
+        /** @brief Number of snapshots waiting for a grace period **/
+        size_t numRetired(){
+            lock_guard<mutex> lock(writerMutex_);
+            return retired_.size();
+        }
+
+    private:
+        void reclaimLocked(){
+            //Oldest subframe any online reader may still ask for
+            bool any = false;
+            unsigned oldest = 0;
+            for(int i=0;i<RCU_MAX_READERS;i++){
+                if(!readers_[i].used.load(memory_order_acquire)) continue;
+                unsigned s = readers_[i].subframe.load(memory_order_relaxed);
+                if(!any || !reached(s, oldest)){oldest = s; any = true;}
+            }
+            //Detach everything older than the newest snapshot already valid for all readers
+            ConfigSnapshot<T> * p = const_cast<ConfigSnapshot<T> *>(head_.load(memory_order_acquire));
+            while(p!=nullptr && any && !reached(oldest, p->firstSubframe))
+                p = const_cast<ConfigSnapshot<T> *>(p->previous.load(memory_order_acquire));
+            if(p!=nullptr){
+                const ConfigSnapshot<T> * detached = p->previous.exchange(nullptr, memory_order_acq_rel);
+                if(detached!=nullptr){
+                    uint64_t epoch = epoch_.fetch_add(1, memory_order_acq_rel)+1;
+                    while(detached!=nullptr){
+                        retired_.push_back({detached, epoch});
+                        detached = detached->previous.load(memory_order_acquire);
+                    }
+                }
+            }
+            freeRetired();
+        }
+};
+#endif  //INCLUDED_RCU_CONFIG_H
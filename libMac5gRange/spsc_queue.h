@@ -0,0 +1,92 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_SPSC_QUEUE_H
+#define INCLUDED_SPSC_QUEUE_H
+
+#include <cstddef>
+#include <vector>
+#include <atomic>
+
+/** Cache line size used to keep producer and consumer indexes apart **/
+#define CACHE_LINE_SIZE 64
+
+using namespace std;
+
+/**
+ * @brief Bounded lock-free single producer / single consumer ring.
+ *
+ * The capacity is rounded up to a power of two. Each side keeps a cached copy of the other
+ * side's index, so the shared cache line is only read when the ring looks full (or empty).
+ */
+template <typename T>
+class SpscQueue {
+    private:
+        vector<T> buffer_;
+        size_t mask_;
+        alignas(CACHE_LINE_SIZE) atomic<size_t> head_ {0};      //Next slot to read (consumer)
+        alignas(CACHE_LINE_SIZE) size_t cachedTail_ = 0;        //Consumer copy of tail_
+        alignas(CACHE_LINE_SIZE) atomic<size_t> tail_ {0};      //Next slot to write (producer)
+        alignas(CACHE_LINE_SIZE) size_t cachedHead_ = 0;        //Producer copy of head_
+
+    public:
+        /**
+         * @brief Construct a new SpscQueue object
+         * @param capacity: minimum number of elements
+         */
+        explicit SpscQueue(size_t capacity){
+            size_t size = 1;
+            while(size<capacity) size <<= 1;
+            buffer_.resize(size);
+            mask_ = size-1;
+        }
+
+        /**
+         * @brief Producer side: appends an element
+         * @return false if the queue is full
+         */
+        bool tryPush(const T & value){
+            const size_t tail = tail_.load(memory_order_relaxed);
+            if(tail-cachedHead_ > mask_){
+                cachedHead_ = head_.load(memory_order_acquire);
+                if(tail-cachedHead_ > mask_) return false;
+            }
+            buffer_[tail&mask_] = value;
+            tail_.store(tail+1, memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief Consumer side: removes the oldest element
+         * @return false if the queue is empty
+         */
+        bool tryPop(T & value){
+            const size_t head = head_.load(memory_order_relaxed);
+            if(head == cachedTail_){
+                cachedTail_ = tail_.load(memory_order_acquire);
+                if(head == cachedTail_) return false;
+            }
+            value = buffer_[head&mask_];
+            head_.store(head+1, memory_order_release);
+            return true;
+        }
+
+        /** @brief Approximate number of elements (exact when called from either side while the other is idle) **/
+        size_t size() const {
+            return tail_.load(memory_order_acquire) - head_.load(memory_order_acquire);
+        }
+
+        /** @brief Indicates if the queue looks empty **/
+        bool empty() const {
+            return size()==0;
+        }
+
+        /** @brief Number of slots **/
+        size_t capacity() const {
+            return mask_+1;
+        }
+};
+#endif  //INCLUDED_SPSC_QUEUE_H
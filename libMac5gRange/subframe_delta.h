@@ -0,0 +1,427 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_SUBFRAME_DELTA_H
+#define INCLUDED_SUBFRAME_DELTA_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include "libMac5gRange.h"
+
+/** Default number of subframes between keyframes **/
+#define DELTA_KEYFRAME_INTERVAL 64
+
+/** Number of past states kept by encoder and decoder (power of two) **/
+#define DELTA_HISTORY_SIZE 16
+
+/** Number of ulReservations tracked one by one in the change bitmap (the others are resent in full) **/
+#define DELTA_MAX_TRACKED_RESERVATIONS 27
+
+enum DeltaMessageType {DELTA_KEYFRAME = 0, DELTA_CHANGES = 1};
+
+/** Type byte flag: the message is equal to the previous one in the sequence **/
+#define DELTA_FLAG_REPEATED 0x80
+
+/** Result of DeltaDecoder::decode() **/
+enum DeltaStatus {
+    DELTA_STATUS_KEYFRAME,      //State replaced by a keyframe
+    DELTA_STATUS_UPDATED,       //Changed fields applied to the state
+    DELTA_STATUS_UNCHANGED,     //Nothing changed: state left as is
+    DELTA_STATUS_MISSING_BASE,  //Base state not available: a keyframe must be requested
+    DELTA_STATUS_MALFORMED      //Message too short or of unknown type
+};
+
+/* Change bitmap of BSSubframeTx_Start */
+#define DELTA_BS_NUM_UES        (1u<<0)
+#define DELTA_BS_NUM_PDUS       (1u<<1)
+#define DELTA_BS_NUMEROLOGY     (1u<<2)     //numerology and fLutDL
+#define DELTA_BS_PHY_CONFIG     (1u<<3)     //ofdm_gfdm and rxMetricPeriodicity
+#define DELTA_BS_ALL_RESERVATIONS (1u<<4)   //ulReservations resent in full
+#define DELTA_BS_RESERVATION(i) (1u<<(5+(i)))
+
+/* Change bitmap of UESubframeTx_Start */
+#define DELTA_UE_RESERVATION    (1u<<0)
+#define DELTA_UE_PHY_CONFIG     (1u<<1)     //ofdm_gfdm, numerology and rxMetricPeriodicity
+
+inline bool sameAllocation(const allocation_cfg_t & a, const allocation_cfg_t & b){
+    return a.target_ue_id==b.target_ue_id && a.first_rb==b.first_rb && a.number_of_rb==b.number_of_rb;
+}
+
+/**
+ * @brief Change bitmap of a BSSubframeTx.Start message against a base state
+ */
+inline uint32_t deltaFields(const BSSubframeTx_Start & base, const BSSubframeTx_Start & current){
+    uint32_t map = 0;
+    if(base.numUEs!=current.numUEs) map |= DELTA_BS_NUM_UES;
+    if(base.numPDUs!=current.numPDUs) map |= DELTA_BS_NUM_PDUS;
+    if(base.numerology!=current.numerology || base.fLutDL!=current.fLutDL) map |= DELTA_BS_NUMEROLOGY;
+    if(base.ofdm_gfdm!=current.ofdm_gfdm || base.rxMetricPeriodicity!=current.rxMetricPeriodicity) map |= DELTA_BS_PHY_CONFIG;
+    if(base.ulReservations.size()!=current.ulReservations.size()) return map|DELTA_BS_ALL_RESERVATIONS;
+    for(size_t i=0;i<current.ulReservations.size();i++){
+        if(sameAllocation(base.ulReservations[i], current.ulReservations[i])) continue;
+        if(i>=DELTA_MAX_TRACKED_RESERVATIONS) return (map&0x1F)|DELTA_BS_ALL_RESERVATIONS;
+        map |= DELTA_BS_RESERVATION(i);
+    }
+    return map;
+}
+
+/**
+ * @brief Serializes the fields of a BSSubframeTx.Start message flagged in the change bitmap
+ */
+inline void pushDelta(vector<uint8_t> & bytes, BSSubframeTx_Start & current, uint32_t map){
+    if(map&DELTA_BS_NUM_UES) push_bytes(bytes, current.numUEs);
+    if(map&DELTA_BS_NUM_PDUS) push_bytes(bytes, current.numPDUs);
+    if(map&DELTA_BS_NUMEROLOGY) push_bytes(bytes, uint8_t((current.numerology<<4)|(current.fLutDL&15)));
+    if(map&DELTA_BS_PHY_CONFIG) push_bytes(bytes, uint8_t((current.ofdm_gfdm<<7)|current.rxMetricPeriodicity));
+    if(map&DELTA_BS_ALL_RESERVATIONS){
+        for(size_t i=0;i<current.ulReservations.size();i++)
+            current.ulReservations[i].serialize(bytes);
+        push_bytes(bytes, uint16_t(current.ulReservations.size()));
+    }
+    else{
+        for(size_t i=0;i<current.ulReservations.size() && i<DELTA_MAX_TRACKED_RESERVATIONS;i++)
+            if(map&DELTA_BS_RESERVATION(i)) current.ulReservations[i].serialize(bytes);
+    }
+}
+
+/**
+ * @brief Applies the fields flagged in the change bitmap to a BSSubframeTx.Start state (inverse order)
+ * @return false if the message is too short
+ */
+inline bool popDelta(BSSubframeTx_Start & state, vector<uint8_t> & bytes, uint32_t map){
+    const size_t reservationSize = 3;
+    if(map&DELTA_BS_ALL_RESERVATIONS){
+        uint16_t count;
+        if(bytes.size()<sizeof(count)) return false;
+        pop_bytes(count, bytes);
+        if(bytes.size()<count*reservationSize) return false;
+        state.ulReservations.resize(count);
+        for(int i=count-1;i>=0;i--)
+            state.ulReservations[i].deserialize(bytes);
+    }
+    else{
+        for(int i=DELTA_MAX_TRACKED_RESERVATIONS-1;i>=0;i--){
+            if(!(map&DELTA_BS_RESERVATION(i))) continue;
+            if(size_t(i)>=state.ulReservations.size() || bytes.size()<reservationSize) return false;
+            state.ulReservations[i].deserialize(bytes);
+        }
+    }
+    uint8_t auxiliary;
+    if(map&DELTA_BS_PHY_CONFIG){
+        if(bytes.empty()) return false;
+        pop_bytes(auxiliary, bytes);
+        state.rxMetricPeriodicity = auxiliary&15;
+        state.ofdm_gfdm = auxiliary>>7;
+    }
+    if(map&DELTA_BS_NUMEROLOGY){
+        if(bytes.empty()) return false;
+        pop_bytes(auxiliary, bytes);
+        state.numerology = (auxiliary>>4)&15;
+        state.fLutDL = auxiliary&15;
+    }
+    if(map&DELTA_BS_NUM_PDUS){
+        if(bytes.empty()) return false;
+        pop_bytes(state.numPDUs, bytes);
+    }
+    if(map&DELTA_BS_NUM_UES){
+        if(bytes.empty()) return false;
+        pop_bytes(state.numUEs, bytes);
+    }
+    return true;
+}
+
+/**
+ * @brief Size of the fields of a BSSubframeTx.Start delta at the end of bytes
+ * @return number of bytes, possibly above bytes.size() if the message is too short
+ */
+inline size_t deltaSize(const BSSubframeTx_Start &, const vector<uint8_t> & bytes, uint32_t map){
+    const size_t reservationSize = 3;
+    size_t size = 0;
+    if(map&DELTA_BS_ALL_RESERVATIONS){
+        uint16_t count;
+        if(bytes.size()<sizeof(count)) return sizeof(count);
+        memcpy(&count, bytes.data()+bytes.size()-sizeof(count), sizeof(count));
+        size += sizeof(count) + count*reservationSize;
+    }
+    else size += __builtin_popcount(map>>5)*reservationSize;
+    size += ((map&DELTA_BS_PHY_CONFIG)!=0) + ((map&DELTA_BS_NUMEROLOGY)!=0) + ((map&DELTA_BS_NUM_PDUS)!=0) +
+            ((map&DELTA_BS_NUM_UES)!=0);
+    return size;
+}
+
+/**
+ * @brief Change bitmap of a UESubframeTx.Start message against a base state
+ */
+inline uint32_t deltaFields(const UESubframeTx_Start & base, const UESubframeTx_Start & current){
+    uint32_t map = 0;
+    if(!sameAllocation(base.ulReservation, current.ulReservation)) map |= DELTA_UE_RESERVATION;
+    if(base.ofdm_gfdm!=current.ofdm_gfdm || base.numerology!=current.numerology ||
+       base.rxMetricPeriodicity!=current.rxMetricPeriodicity) map |= DELTA_UE_PHY_CONFIG;
+    return map;
+}
+
+/**
+ * @brief Serializes the fields of a UESubframeTx.Start message flagged in the change bitmap
+ */
+inline void pushDelta(vector<uint8_t> & bytes, UESubframeTx_Start & current, uint32_t map){
+    if(map&DELTA_UE_RESERVATION) current.ulReservation.serialize(bytes);
+    if(map&DELTA_UE_PHY_CONFIG)
+        push_bytes(bytes, uint8_t((current.ofdm_gfdm<<7)|((current.numerology&7)<<4)|current.rxMetricPeriodicity));
+}
+
+/**
+ * @brief Applies the fields flagged in the change bitmap to a UESubframeTx.Start state (inverse order)
+ * @return false if the message is too short
+ */
+inline bool popDelta(UESubframeTx_Start & state, vector<uint8_t> & bytes, uint32_t map){
+    if(map&DELTA_UE_PHY_CONFIG){
+        if(bytes.empty()) return false;
+        uint8_t auxiliary;
+        pop_bytes(auxiliary, bytes);
+        state.rxMetricPeriodicity = auxiliary&15;
+        state.numerology = (auxiliary>>4)&7;
+        state.ofdm_gfdm = auxiliary>>7;
+    }
+    if(map&DELTA_UE_RESERVATION){
+        if(bytes.size()<3) return false;
+        state.ulReservation.deserialize(bytes);
+    }
+    return true;
+}
+
+/**
+ * @brief Size of the fields of a UESubframeTx.Start delta at the end of bytes
+ */
+inline size_t deltaSize(const UESubframeTx_Start &, const vector<uint8_t> &, uint32_t map){
+    return ((map&DELTA_UE_RESERVATION) ? 3 : 0) + ((map&DELTA_UE_PHY_CONFIG) ? 1 : 0);
+}
+
+/**
+ * @brief Sender side of the delta mode of a subframe start message (BSSubframeTx_Start or UESubframeTx_Start).
+ *
+ * Each message gets a 16-bit sequence number. A message is either a keyframe (the regular serialization) or a
+ * change bitmap plus the changed fields against the last state the receiver acknowledged. Messages equal to
+ * the previous one are flagged, so a receiver that got the previous one skips parsing them altogether.
+ * Keyframes are sent when nothing was acknowledged yet, every keyframeInterval subframes, and on request
+ * (see: requestKeyframe()), and when the acknowledged base falls DELTA_HISTORY_SIZE or more messages behind,
+ * since the receiver no longer holds it. Over a lossless transport the sender may acknowledge each message itself
+ * right after encoding it.
+ * Message trailer (pushed last, popped first): [fields][bitmap:4][base sequence:2][sequence:2][type:1]; keyframes
+ * carry the length of their serialization in place of the bitmap, so messages can be stacked in one vector.
+ */
+template <typename T>
+class DeltaEncoder{
+    private:
+        typedef struct{
+            uint16_t sequence;
+            bool valid;
+            T state;
+        }HistoryEntry;
+
+        unsigned keyframeInterval_;
+        uint16_t sequence_ = 0;                 //Sequence number of the last encoded message
+        unsigned sinceKeyframe_ = 0;
+        bool forceKeyframe_ = true;
+        bool hasBase_ = false;
+        uint16_t baseSequence_ = 0;             //Last acknowledged message
+        T base_;                                //State of the last acknowledged message
+        HistoryEntry history_[DELTA_HISTORY_SIZE] {};
+
+    public:
+        /**
+         * @brief Construct a new DeltaEncoder object
+         * @param keyframeInterval: maximum number of subframes between keyframes
+         */
+        explicit DeltaEncoder(unsigned keyframeInterval = DELTA_KEYFRAME_INTERVAL){
+            keyframeInterval_ = keyframeInterval;
+        }
+
+        /**
+         * @brief Serializes a message in delta mode, appending it at the end of bytes
+         * @param message: message to be sent
+         * @param bytes: vector of bytes where the message will be serialized
+         * @return sequence number of the message
+         */
+        uint16_t encode(T & message, vector<uint8_t> & bytes){
+            uint16_t sequence = ++sequence_;
+            bool keyframe = forceKeyframe_ || !hasBase_ || sinceKeyframe_+1>=keyframeInterval_ ||
+                            uint16_t(sequence-baseSequence_)>=DELTA_HISTORY_SIZE;
+            const HistoryEntry & previous = history_[uint16_t(sequence-1)&(DELTA_HISTORY_SIZE-1)];
+            bool repeated = !keyframe && previous.valid && previous.sequence==uint16_t(sequence-1) &&
+                            deltaFields(previous.state, message)==0;
+            if(keyframe){
+                size_t start = bytes.size();
+                message.serialize(bytes);
+                push_bytes(bytes, uint32_t(bytes.size()-start));
+                push_bytes(bytes, sequence);
+                sinceKeyframe_ = 0;
+                forceKeyframe_ = false;
+            }
+            else{
+                uint32_t map = deltaFields(base_, message);
+                pushDelta(bytes, message, map);
+                push_bytes(bytes, map);
+                push_bytes(bytes, baseSequence_);
+                sinceKeyframe_++;
+            }
+            push_bytes(bytes, sequence);
+            push_bytes(bytes, uint8_t((keyframe ? DELTA_KEYFRAME : DELTA_CHANGES)|(repeated ? DELTA_FLAG_REPEATED : 0)));
+
+            HistoryEntry & entry = history_[sequence&(DELTA_HISTORY_SIZE-1)];
+            entry.sequence = sequence;
+            entry.valid = true;
+            entry.state = message;
+            return sequence;
+        }
+
+        /**
+         * @brief The receiver decoded a message: later deltas are encoded against it
+         * Acknowledgements older than the current base, or of messages no longer in the history, are ignored.
+         * @param sequence: sequence number of the decoded message
+         */
+        void acknowledge(uint16_t sequence){
+            if(hasBase_ && int16_t(sequence-baseSequence_)<=0) return;
+            const HistoryEntry & entry = history_[sequence&(DELTA_HISTORY_SIZE-1)];
+            if(!entry.valid || entry.sequence!=sequence) return;
+            base_ = entry.state;
+            baseSequence_ = sequence;
+            hasBase_ = true;
+        }
+
+        /** @brief Sends the next message as a keyframe (e.g. after DELTA_STATUS_MISSING_BASE) **/
+        void requestKeyframe(){
+            forceKeyframe_ = true;
+        }
+
+        /** @brief Sequence number of the last encoded message **/
+        uint16_t sequence() const{
+            return sequence_;
+        }
+};
+
+/**
+ * @brief Receiver side of the delta mode (see: DeltaEncoder).
+ *
+ * The decoded message is kept in place: unchanged messages leave it untouched and deltas only overwrite the
+ * changed fields, so the receiver can skip its own processing when decode() returns DELTA_STATUS_UNCHANGED.
+ */
+template <typename T>
+class DeltaDecoder{
+    private:
+        typedef struct{
+            uint16_t sequence;
+            bool valid;
+            T state;
+        }HistoryEntry;
+
+        T state_ {};
+        bool hasState_ = false;
+        uint16_t sequence_ = 0;                 //Sequence number of state_
+        uint64_t lost_ = 0;
+        HistoryEntry history_[DELTA_HISTORY_SIZE] {};
+        vector<uint8_t> keyframe_;              //Keyframe split from the stream (deserialize() reads to the front)
+
+        void store(){
+            HistoryEntry & entry = history_[sequence_&(DELTA_HISTORY_SIZE-1)];
+            entry.sequence = sequence_;
+            entry.valid = true;
+            entry.state = state_;
+        }
+
+    public:
+        /**
+         * @brief Decodes a message (consuming the bytes, as deserialize() does)
+         * The whole message is consumed whatever the result, so the caller can go on with the preceding bytes;
+         * only for a message of unknown type (whose fields cannot be sized) is the trailer alone consumed.
+         * @param bytes: serialized message (see: DeltaEncoder::encode())
+         * @return what happened to the state
+         */
+        DeltaStatus decode(vector<uint8_t> & bytes){
+            if(bytes.size()<9){
+                bytes.clear();
+                return DELTA_STATUS_MALFORMED;
+            }
+            uint8_t type;
+            uint16_t sequence, baseSequence;
+            uint32_t map;
+            pop_bytes(type, bytes);
+            pop_bytes(sequence, bytes);
+            pop_bytes(baseSequence, bytes);
+            pop_bytes(map, bytes);
+            bool repeated = type&DELTA_FLAG_REPEATED;
+            type &= ~DELTA_FLAG_REPEATED;
+            if(type!=DELTA_KEYFRAME && type!=DELTA_CHANGES) return DELTA_STATUS_MALFORMED;
+
+            if(hasState_ && uint16_t(sequence-sequence_)>1 && int16_t(sequence-sequence_)>0)
+                lost_ += uint16_t(sequence-sequence_)-1;
+
+            if(type==DELTA_KEYFRAME){
+                if(map>bytes.size()){
+                    bytes.clear();
+                    return DELTA_STATUS_MALFORMED;
+                }
+                keyframe_.assign(bytes.end()-map, bytes.end());
+                bytes.resize(bytes.size()-map);
+                state_.deserialize(keyframe_);
+                hasState_ = true;
+                sequence_ = sequence;
+                store();
+                return DELTA_STATUS_KEYFRAME;
+            }
+
+            //Start of the message: every return below leaves bytes there
+            const size_t start = bytes.size() - min(bytes.size(), deltaSize(state_, bytes, map));
+            if(!hasState_){
+                bytes.resize(start);
+                return DELTA_STATUS_MISSING_BASE;
+            }
+            if(repeated && sequence==uint16_t(sequence_+1)){
+                //Same as the state we hold: nothing to parse
+                bytes.resize(start);
+                sequence_ = sequence;
+                store();
+                return DELTA_STATUS_UNCHANGED;
+            }
+            bool rebased = false;
+            if(baseSequence!=sequence_){
+                //Delta against an older state than the current one
+                const HistoryEntry & entry = history_[baseSequence&(DELTA_HISTORY_SIZE-1)];
+                if(!entry.valid || entry.sequence!=baseSequence){
+                    bytes.resize(start);
+                    return DELTA_STATUS_MISSING_BASE;
+                }
+                state_ = entry.state;
+                rebased = true;
+            }
+            if(map!=0 && !popDelta(state_, bytes, map)){
+                bytes.resize(start);
+                hasState_ = false;      //State partially updated: wait for a keyframe
+                return DELTA_STATUS_MALFORMED;
+            }
+            bytes.resize(start);
+            sequence_ = sequence;
+            store();
+            return (map==0 && !rebased) ? DELTA_STATUS_UNCHANGED : DELTA_STATUS_UPDATED;
+        }
+
+        /** @brief Decoded message **/
+        const T & state() const{
+            return state_;
+        }
+
+        /** @brief Sequence number of the decoded message (to be acknowledged to the encoder) **/
+        uint16_t sequence() const{
+            return sequence_;
+        }
+
+        /** @brief Number of messages skipped in the sequence **/
+        uint64_t lost() const{
+            return lost_;
+        }
+};
+#endif  //INCLUDED_SUBFRAME_DELTA_H
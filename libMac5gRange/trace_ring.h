@@ -0,0 +1,397 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_TRACE_RING_H
+#define INCLUDED_TRACE_RING_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <ostream>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "libMac5gRange.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define TRACE_MAGIC "5GRTRACE"
+#define TRACE_VERSION 1
+#define TRACE_DEFAULT_RING_RECORDS 16384    //Records per thread ring (power of two)
+#define TRACE_DEFAULT_MAX_THREADS 32
+#define TRACE_MAX_EVENTS 256
+#define TRACE_NAME_LEN 32
+#define TRACE_PATH_LEN 256
+
+/** Record phases (as in the Chrome trace event format) **/
+enum TracePhase {TRACE_BEGIN = 'B', TRACE_END = 'E', TRACE_INSTANT = 'i'};
+
+/** Predefined hot path events (user events start at TRACE_EV_USER) **/
+enum TraceEvents {
+    TRACE_EV_SCHEDULE = 1,      //Scheduling of a subframe
+    TRACE_EV_PDU_BUILD,         //MacPDU building
+    TRACE_EV_SERIALIZE,         //MacPDU::serialize
+    TRACE_EV_DESERIALIZE,       //MacPDU deserialization
+    TRACE_EV_MQ_SEND,           //mq_send to the PHY
+    TRACE_EV_MQ_RECEIVE,        //mq_receive from the PHY
+    TRACE_EV_SUBFRAME_TICK,     //Start of a subframe
+    TRACE_EV_DEADLINE_MISS,     //Stage went over its deadline
+    TRACE_EV_USER = 32
+};
+
+/**
+ * @brief Fixed-size binary trace record (32 bytes)
+ */
+typedef struct{
+    uint64_t tsc;           //Time stamp counter
+    uint16_t event;         //Event id
+    uint8_t phase;          //TracePhase
+    uint8_t ue;             //UE id (allocation_cfg_t::target_ue_id)
+    uint32_t subframe;      //macphyctl_t::subframe_number
+    uint32_t size;          //Size argument (e.g. bytes)
+    uint32_t size2;         //Second size argument (e.g. queue occupancy)
+    uint32_t tid;           //Kernel thread id
+    uint32_t reserved;
+}TraceRecord;
+
+/**
+ * @brief Header of one per-thread ring
+ */
+typedef struct{
+    atomic<uint64_t> head;          //Number of records written (next slot: head % capacity)
+    uint32_t tid;                   //Last owner thread id (0: never used)
+    atomic<uint32_t> inUse;         //1 while a live thread owns the ring
+    char name[TRACE_NAME_LEN];      //Owner thread name
+}TraceRingHeader;
+
+/**
+ * @brief Header of the trace region, followed by the ring headers and the rings
+ */
+typedef struct{
+    char magic[8];                                      //TRACE_MAGIC
+    uint32_t version;                                   //TRACE_VERSION
+    uint32_t recordSize;                                //sizeof(TraceRecord)
+    uint32_t ringRecords;                               //Records per ring
+    uint32_t maxThreads;                                //Number of rings
+    double tscPerNs;                                    //TSC ticks per ns
+    uint64_t tscBase;                                   //TSC value at nsBase
+    uint64_t nsBase;                                    //CLOCK_MONOTONIC time at tscBase
+    atomic<uint32_t> numRings;                          //Rings owned by live threads
+    uint32_t reserved;
+    char eventNames[TRACE_MAX_EVENTS][TRACE_NAME_LEN];  //Event names, indexed by event id
+}TraceFileHeader;
+
+/**
+ * @brief Per-thread lock-free trace rings living in one mmap-able region.
+ *
+ * init() must be called once before tracing: events recorded earlier are ignored. Each thread claims a free ring
+ * on its first event and is the only writer of it, so recording an event is a TSC read, a 32-byte store and a
+ * release store of the ring head. The ring is released when the thread exits and the next new thread reuses it,
+ * so short-lived threads do not use up the rings; threads that find no free ring are not traced and skip later
+ * events at once. Rings wrap around, keeping the newest records (a reused ring keeps the tail of the previous
+ * owner until it is overwritten). With a path (e.g. /dev/shm/mac.trace) the region is a shared file mapping that other processes can
+ * mmap while the MAC runs; dump() and the optional signal handler write a consistent-enough copy to a file.
+ */
+class TraceBuffer{
+    private:
+        uint8_t * region_ = nullptr;
+        size_t regionSize_ = 0;
+        TraceFileHeader * header_ = nullptr;
+        atomic<bool> ready_ {false};            //Region initialized (published by init())
+        char signalDumpPath_[TRACE_PATH_LEN];
+
+        static uint64_t monotonicNs(){
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return uint64_t(ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+        }
+
+        TraceBuffer(){
+            signalDumpPath_[0] = 0;
+        }
+
+        /** Releases the ring of a thread when the thread exits **/
+        struct RingRelease{
+            TraceRingHeader ** ring = nullptr;  //The thread's ring pointer in record()
+            bool * untraced = nullptr;          //The thread's untraced flag in record()
+            TraceFileHeader * header = nullptr;
+            ~RingRelease(){
+                if(ring==nullptr || *ring==nullptr) return;
+                TraceRingHeader * r = *ring;
+                *ring = nullptr;
+                *untraced = true;               //Events from later thread_local destructors are dropped
+                header->numRings.fetch_sub(1, memory_order_relaxed);
+                r->inUse.store(0, memory_order_release);
+            }
+        };
+
+        static void signalHandler(int){
+            TraceBuffer & tb = instance();
+            if(tb.signalDumpPath_[0]!=0) tb.dump(tb.signalDumpPath_);
+        }
+
+    public:
+        /** @brief Process-wide trace buffer **/
+        static TraceBuffer & instance(){
+            static TraceBuffer buffer;
+            return buffer;
+        }
+
+        /** @brief Reads the time stamp counter (CLOCK_MONOTONIC ns where there is none) **/
+        static inline uint64_t timestamp(){
+#if defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+#else
+            return monotonicNs();
+#endif
+        }
+
+        /**
+         * @brief Allocates the trace region (call once, before the traced threads start)
+         * @param path: file to back the region (e.g. under /dev/shm), nullptr for anonymous memory
+         * @param ringRecords: records per thread ring (rounded up to a power of two)
+         * @param maxThreads: number of rings
+         * @return false on error
+         */
+        bool init(const char * path = nullptr, uint32_t ringRecords = TRACE_DEFAULT_RING_RECORDS, uint32_t maxThreads = TRACE_DEFAULT_MAX_THREADS){
+            static mutex initMutex;
+            lock_guard<mutex> lock(initMutex);
+            if(ready_.load(memory_order_acquire)) return true;
+            uint32_t records = 1;
+            while(records<ringRecords) records <<= 1;
+            regionSize_ = sizeof(TraceFileHeader) + maxThreads*(sizeof(TraceRingHeader) + size_t(records)*sizeof(TraceRecord));
+            int fd = -1;
+            if(path!=nullptr){
+                fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+                if(fd==-1 || ftruncate(fd, regionSize_)==-1){
+                    perror("Error creating trace file");
+                    if(fd!=-1) close(fd);
+                    return false;
+                }
+            }
+            void * p = mmap(NULL, regionSize_, PROT_READ|PROT_WRITE, fd==-1 ? MAP_PRIVATE|MAP_ANONYMOUS : MAP_SHARED, fd, 0);
+            if(fd!=-1) close(fd);
+            if(p==MAP_FAILED){
+                perror("Error mapping trace region");
+                return false;
+            }
+            memset(p, 0, regionSize_);
+            region_ = (uint8_t *) p;
+            header_ = (TraceFileHeader *) region_;
+            memcpy(header_->magic, TRACE_MAGIC, 8);
+            header_->version = TRACE_VERSION;
+            header_->recordSize = sizeof(TraceRecord);
+            header_->ringRecords = records;
+            header_->maxThreads = maxThreads;
+
+            //TSC calibration against CLOCK_MONOTONIC
+            uint64_t ns0 = monotonicNs(), tsc0 = timestamp();
+            timespec pause = {0, 10000000};
+            nanosleep(&pause, NULL);
+            uint64_t ns1 = monotonicNs(), tsc1 = timestamp();
+            header_->tscPerNs = double(tsc1-tsc0)/double(ns1-ns0);
+            header_->tscBase = tsc0;
+            header_->nsBase = ns0;
+
+            const char * names[] = {"", "schedule", "pdu_build", "serialize", "deserialize", "mq_send",
+                                    "mq_receive", "subframe_tick", "deadline_miss"};
+            for(uint16_t i=1;i<sizeof(names)/sizeof(names[0]);i++) nameEvent(i, names[i]);
+            ready_.store(true, memory_order_release);
+            return true;
+        }
+
+        /** @brief Sets the name of an event id (shown by the converter) **/
+        void nameEvent(uint16_t event, const char * name){
+            if(header_==nullptr || event>=TRACE_MAX_EVENTS) return;
+            strncpy(header_->eventNames[event], name, TRACE_NAME_LEN-1);
+        }
+
+        /** @brief Ring header of ring i **/
+        TraceRingHeader * ringHeader(uint32_t i){
+            return (TraceRingHeader *) (region_ + sizeof(TraceFileHeader) + i*sizeof(TraceRingHeader));
+        }
+
+        /** @brief Records of ring i **/
+        TraceRecord * ringRecords(uint32_t i){
+            uint8_t * rings = region_ + sizeof(TraceFileHeader) + header_->maxThreads*sizeof(TraceRingHeader);
+            return (TraceRecord *) (rings + size_t(i)*header_->ringRecords*sizeof(TraceRecord));
+        }
+
+        /**
+         * @brief Hot path: appends a record to the ring of the calling thread (no-op before init())
+         */
+        inline void record(uint16_t event, uint8_t phase, uint32_t subframe, uint8_t ue, uint32_t size, uint32_t size2 = 0){
+            thread_local TraceRingHeader * ring = nullptr;
+            thread_local TraceRecord * records = nullptr;
+            thread_local uint32_t tid = 0;
+            thread_local bool untraced = false;      //No free ring, or thread exiting: this thread is not traced
+            if(ring==nullptr){
+                if(untraced || !ready_.load(memory_order_acquire)) return;
+                //Claim the first free ring; acquire pairs with the release of the previous owner
+                uint32_t i = 0;
+                for(;i<header_->maxThreads;i++){
+                    uint32_t expected = 0;
+                    TraceRingHeader * r = ringHeader(i);
+                    if(r->inUse.load(memory_order_relaxed)==0 &&
+                       r->inUse.compare_exchange_strong(expected, 1, memory_order_acquire)) break;
+                }
+                if(i==header_->maxThreads){
+                    untraced = true;
+                    return;
+                }
+                header_->numRings.fetch_add(1, memory_order_relaxed);
+                ring = ringHeader(i);
+                records = ringRecords(i);
+                //Only touched here, so the hot path keeps trivially destructible thread_locals
+                thread_local RingRelease release;
+                release.ring = &ring;
+                release.untraced = &untraced;
+                release.header = header_;
+                tid = (uint32_t) syscall(SYS_gettid);
+                ring->tid = tid;
+                snprintf(ring->name, TRACE_NAME_LEN, "thread-%u", tid);
+            }
+            const uint64_t head = ring->head.load(memory_order_relaxed);
+            TraceRecord & r = records[head & (header_->ringRecords-1)];
+            r.tsc = timestamp();
+            r.event = event;
+            r.phase = phase;
+            r.ue = ue;
+            r.subframe = subframe;
+            r.size = size;
+            r.size2 = size2;
+            r.tid = tid;
+            ring->head.store(head+1, memory_order_release);
+        }
+
+        /**
+         * @brief Writes the whole region to a file (async-signal-safe: only open/write/close)
+         * @return false on error
+         */
+        bool dump(const char * path){
+            if(!ready_.load(memory_order_acquire)) return false;
+            int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+            if(fd==-1) return false;
+            size_t written = 0;
+            while(written<regionSize_){
+                ssize_t n = write(fd, region_+written, regionSize_-written);
+                if(n<=0) break;
+                written += n;
+            }
+            close(fd);
+            return written==regionSize_;
+        }
+
+        /**
+         * @brief Dumps the region to a file whenever the process receives a signal
+         * @param signum: signal (e.g. SIGUSR2)
+         * @param path: dump file
+         */
+        void dumpOnSignal(int signum, const char * path){
+            strncpy(signalDumpPath_, path, TRACE_PATH_LEN-1);
+            signalDumpPath_[TRACE_PATH_LEN-1] = 0;
+            struct sigaction sa;
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_handler = &TraceBuffer::signalHandler;
+            sa.sa_flags = SA_RESTART;
+            sigaction(signum, &sa, NULL);
+        }
+};
+
+#ifndef MAC_TRACE_DISABLED
+/** Records an event: TRACE_EVENT(event, phase, subframe, ue, size) **/
+#define TRACE_EVENT(event, phase, subframe, ue, size) \
+    TraceBuffer::instance().record((event), (phase), (subframe), (ue), (size))
+/** Records an event with a second size argument: TRACE_EVENT2(event, phase, subframe, ue, size, size2) **/
+#define TRACE_EVENT2(event, phase, subframe, ue, size, size2) \
+    TraceBuffer::instance().record((event), (phase), (subframe), (ue), (size), (size2))
+#else
+#define TRACE_EVENT(event, phase, subframe, ue, size) do{}while(0)
+#define TRACE_EVENT2(event, phase, subframe, ue, size, size2) do{}while(0)
+#endif
+
+/**
+ * @brief Records a begin event on construction and the matching end event on destruction
+ */
+class TraceScope{
+    private:
+        uint16_t event_;
+        uint32_t subframe_;
+        uint8_t ue_;
+    public:
+        TraceScope(uint16_t event, uint32_t subframe, uint8_t ue, uint32_t size)
+        : event_(event), subframe_(subframe), ue_(ue){
+            TRACE_EVENT(event_, TRACE_BEGIN, subframe_, ue_, size);
+        }
+        ~TraceScope(){
+            TRACE_EVENT(event_, TRACE_END, subframe_, ue_, 0);
+        }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+/** Traces the enclosing scope: TRACE_SCOPE(event, subframe, ue, size) **/
+#define TRACE_SCOPE(event, subframe, ue, size) \
+    TraceScope TRACE_CONCAT(traceScope_, __LINE__)((event), (subframe), (ue), (size))
+
+/**
+ * @brief Converts a trace dump (see: TraceBuffer::dump()) into Chrome/Perfetto trace event JSON
+ * @param path: dump file
+ * @param out: stream where the JSON is written
+ * @return number of converted records, or -1 if the file is not a trace dump
+ */
+inline long traceToChromeJson(const char * path, ostream & out){
+    FILE * f = fopen(path, "rb");
+    if(f==NULL) return -1;
+    vector<uint8_t> data;
+    uint8_t chunk[65536];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), f))>0) data.insert(data.end(), chunk, chunk+n);
+    fclose(f);
+    if(data.size()<sizeof(TraceFileHeader)) return -1;
+    const TraceFileHeader * h = (const TraceFileHeader *) data.data();
+    if(memcmp(h->magic, TRACE_MAGIC, 8)!=0 || h->version!=TRACE_VERSION || h->recordSize!=sizeof(TraceRecord)) return -1;
+    const size_t expected = sizeof(TraceFileHeader) + size_t(h->maxThreads)*(sizeof(TraceRingHeader) + size_t(h->ringRecords)*sizeof(TraceRecord));
+    if(data.size()<expected) return -1;
+
+    const uint8_t * rings = data.data() + sizeof(TraceFileHeader) + h->maxThreads*sizeof(TraceRingHeader);
+    long count = 0;
+    out << "{\"traceEvents\":[";
+    for(uint32_t i=0;i<h->maxThreads;i++){
+        const TraceRingHeader * rh = (const TraceRingHeader *) (data.data() + sizeof(TraceFileHeader) + i*sizeof(TraceRingHeader));
+        if(rh->tid==0) continue;
+        out << (count>0 ? "," : "") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << rh->tid
+            << ",\"args\":{\"name\":\"" << rh->name << "\"}}";
+        count++;
+        const uint64_t head = rh->head.load();
+        const uint64_t first = head>h->ringRecords ? head-h->ringRecords : 0;
+        const TraceRecord * records = (const TraceRecord *) (rings + size_t(i)*h->ringRecords*sizeof(TraceRecord));
+        for(uint64_t j=first;j<head;j++){
+            const TraceRecord & r = records[j & (h->ringRecords-1)];
+            double us = (double(h->nsBase) + (double(r.tsc) - double(h->tscBase))/h->tscPerNs)/1000.0;
+            char name[TRACE_NAME_LEN+1] = {0};
+            if(r.event<TRACE_MAX_EVENTS) memcpy(name, h->eventNames[r.event], TRACE_NAME_LEN);
+            out << ",\n{\"name\":\"";
+            if(name[0]!=0) out << name;
+            else out << "event_" << r.event;
+            out << "\",\"ph\":\"" << char(r.phase) << "\",\"ts\":" << fixed << us << ",\"pid\":0,\"tid\":" << r.tid;
+            if(r.phase==TRACE_INSTANT) out << ",\"s\":\"t\"";
+            out << ",\"args\":{\"subframe\":" << r.subframe << ",\"ue\":" << unsigned(r.ue)
+                << ",\"size\":" << r.size << ",\"size2\":" << r.size2 << "}}";
+            count++;
+        }
+    }
+    out << "\n]}\n";
+    return count;
+}
+#endif  //INCLUDED_TRACE_RING_H
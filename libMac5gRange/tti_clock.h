@@ -0,0 +1,262 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_TTI_CLOCK_H
+#define INCLUDED_TTI_CLOCK_H
+
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <atomic>
+#include <cerrno>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "libMac5gRange.h"
+
+/** Largest number of stages tracked by a TtiClock **/
+#define TTI_MAX_STAGES 16
+
+/** Number of deadline usage histogram bins (10% wide, last bin holds everything above 100%) **/
+#define TTI_HISTOGRAM_BINS 11
+
+#define NS_PER_SECOND 1000000000ULL
+
+enum TtiClockSource {TTI_CLOCK_NANOSLEEP, TTI_CLOCK_TIMERFD};
+
+/**
+ * @brief Deadline statistics of one stage
+ */
+typedef struct{
+    string name;                                //Stage name
+    double budget;                              //Fraction of the subframe period the stage may use
+    uint64_t samples;                           //Number of recorded subframes
+    uint64_t misses;                            //Subframes where the stage went over its budget
+    double avgUsage;                            //Average used fraction of the subframe period
+    double maxUsage;                            //Largest used fraction of the subframe period
+    uint64_t histogram[TTI_HISTOGRAM_BINS];     //Used fraction histogram: [0,10%), [10%,20%), ... [100%, inf)
+}StageDeadlineStats;
+
+/**
+ * @brief Real-time subframe (TTI) clock of a numerology.
+ *
+ * The period is the subframe duration given by the numerology and SAMPLE_RATE (see: get_subframe_duration()).
+ * Ticks are absolute deadlines on CLOCK_MONOTONIC, either slept on with clock_nanosleep(TIMER_ABSTIME) or
+ * read from a timerfd (which can also be polled with epoll). Late wake ups never shift the time base: the
+ * missed subframes are counted and skipped. Stages record, per subframe, which fraction of the period they
+ * used, measured from the start of the subframe given by macphyctl_t::subframe_number.
+ */
+class TtiClock{
+    private:
+        typedef struct{
+            string name;
+            double budget = 1.0;
+            atomic<uint64_t> samples {0};
+            atomic<uint64_t> misses {0};
+            atomic<uint64_t> usageSumPpm {0};       //Sum of used fractions, in parts per million
+            atomic<uint64_t> maxUsagePpm {0};
+            atomic<uint64_t> histogram[TTI_HISTOGRAM_BINS] {};
+        }StageRecord;
+
+        unsigned numerology_;
+        TtiClockSource source_;
+        uint64_t periodNs_;
+        uint64_t baseNs_ = 0;               //Start of firstSubframe_
+        unsigned firstSubframe_ = 0;
+        atomic<unsigned> current_ {0};      //Subframe whose period is running
+        atomic<uint64_t> missedTicks_ {0};
+        int timerFd_ = -1;
+        StageRecord stages_[TTI_MAX_STAGES];
+        atomic<int> numStages_ {0};
+
+        static timespec toTimespec(uint64_t ns){
+            timespec ts;
+            ts.tv_sec = ns/NS_PER_SECOND;
+            ts.tv_nsec = ns%NS_PER_SECOND;
+            return ts;
+        }
+
+    public:
+        /**
+         * @brief Construct a new TtiClock object
+         * @param numerology: (0 - 5) numerology defining the subframe period
+         * @param source: waiting mechanism
+         */
+        TtiClock(unsigned numerology, TtiClockSource source = TTI_CLOCK_NANOSLEEP){
+            numerology_ = numerology;
+            source_ = source;
+            periodNs_ = (uint64_t) llround(get_subframe_duration(numerology)*1e9);
+            if(source_==TTI_CLOCK_TIMERFD){
+                timerFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+                if(timerFd_==-1)
+                    perror("Error creating TTI timerfd");
+            }
+        }
+
+        /** @brief Closes the timerfd **/
+        ~TtiClock(){
+            if(timerFd_!=-1) close(timerFd_);
+        }
+
+        /** @brief Current CLOCK_MONOTONIC time in ns **/
+        static uint64_t nowNs(){
+            timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return uint64_t(ts.tv_sec)*NS_PER_SECOND + ts.tv_nsec;
+        }
+
+        /** @brief Subframe period in ns **/
+        uint64_t periodNs() const{
+            return periodNs_;
+        }
+
+        /** @brief Numerology of the clock **/
+        unsigned numerology() const{
+            return numerology_;
+        }
+
+        /** @brief Timerfd descriptor (-1 with TTI_CLOCK_NANOSLEEP) **/
+        int fd() const{
+            return timerFd_;
+        }
+
+        /**
+         * @brief Starts the clock; the first tick (start of firstSubframe) is one period from now
+         * @param firstSubframe: number of the first subframe
+         */
+        void start(unsigned firstSubframe = 0){
+            firstSubframe_ = firstSubframe;
+            baseNs_ = nowNs()+periodNs_;
+            current_.store(firstSubframe-1, memory_order_release);
+            if(timerFd_!=-1){
+                itimerspec spec;
+                spec.it_value = toTimespec(baseNs_);
+                spec.it_interval = toTimespec(periodNs_);
+                if(timerfd_settime(timerFd_, TFD_TIMER_ABSTIME, &spec, NULL)==-1)
+                    perror("Error arming TTI timerfd");
+            }
+        }
+
+        /** @brief Start time (ns, CLOCK_MONOTONIC) of a subframe **/
+        uint64_t subframeStartNs(unsigned subframe) const{
+            return baseNs_ + uint64_t(int64_t(int32_t(subframe-firstSubframe_)))*periodNs_;
+        }
+
+        /**
+         * @brief Blocks until the start of the next subframe
+         * If the caller is late, the subframes whose start already passed are counted as missed ticks
+         * and skipped.
+         * @return number of the subframe that just started
+         */
+        unsigned waitNextSubframe(){
+            unsigned next = current_.load(memory_order_relaxed)+1;
+            if(timerFd_!=-1){
+                uint64_t expirations = 0;
+                if(read(timerFd_, &expirations, sizeof(expirations))!=sizeof(expirations))
+                    perror("Error reading TTI timerfd");
+                if(expirations>1) missedTicks_.fetch_add(expirations-1, memory_order_relaxed);
+                //Expirations count from the last read, so use the time base to stay exact
+                uint64_t now = nowNs();
+                unsigned elapsed = (now - baseNs_)/periodNs_;
+                next = firstSubframe_ + elapsed;
+            }
+            else{
+                uint64_t now = nowNs();
+                uint64_t deadline = subframeStartNs(next);
+                if(now >= deadline + periodNs_){
+                    unsigned late = (now - deadline)/periodNs_;
+                    missedTicks_.fetch_add(late, memory_order_relaxed);
+                    next += late;
+                    deadline = subframeStartNs(next);
+                }
+                timespec ts = toTimespec(deadline);
+                while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)==EINTR);
+            }
+            current_.store(next, memory_order_release);
+            return next;
+        }
+
+        /** @brief Subframe whose period is running **/
+        unsigned currentSubframe() const{
+            return current_.load(memory_order_acquire);
+        }
+
+        /** @brief Sets the subframe number of a MAC/PHY control struct to the running subframe **/
+        void tag(macphyctl_t & ctl) const{
+            ctl.subframe_number = currentSubframe();
+        }
+
+        /** @brief Number of subframe starts that went by while the clock owner was late **/
+        uint64_t missedTicks() const{
+            return missedTicks_.load(memory_order_relaxed);
+        }
+
+        /**
+         * @brief Fraction of the period of a subframe elapsed at a given time (above 1 means late)
+         * @param subframe: subframe number (see: macphyctl_t::subframe_number)
+         * @param now: time in ns (defaults to now)
+         */
+        double deadlineUsage(unsigned subframe, uint64_t now = 0) const{
+            if(now==0) now = nowNs();
+            return (double(now) - double(subframeStartNs(subframe)))/double(periodNs_);
+        }
+
+        /**
+         * @brief Registers a stage
+         * @param name: stage name
+         * @param budget: fraction of the subframe period the stage may use before a miss is counted
+         * @return stage id, or -1 if TTI_MAX_STAGES are registered
+         */
+        int addStage(const string & name, double budget = 1.0){
+            int id = numStages_.load();
+            if(id>=TTI_MAX_STAGES) return -1;
+            stages_[id].name = name;
+            stages_[id].budget = budget;
+            numStages_.store(id+1);
+            return id;
+        }
+
+        /**
+         * @brief Records that a stage finished its work for a subframe (one writer per stage)
+         * @param stage: stage id
+         * @param subframe: subframe the work belongs to (see: macphyctl_t::subframe_number)
+         * @return used fraction of the subframe period
+         */
+        double recordStage(int stage, unsigned subframe){
+            StageRecord & r = stages_[stage];
+            double usage = deadlineUsage(subframe);
+            if(usage<0) usage = 0;
+            uint64_t ppm = (uint64_t) (usage*1e6);
+            r.samples.fetch_add(1, memory_order_relaxed);
+            r.usageSumPpm.fetch_add(ppm, memory_order_relaxed);
+            if(ppm > r.maxUsagePpm.load(memory_order_relaxed)) r.maxUsagePpm.store(ppm, memory_order_relaxed);
+            if(usage > r.budget) r.misses.fetch_add(1, memory_order_relaxed);
+            size_t bin = (size_t) (usage*10);
+            if(bin>=TTI_HISTOGRAM_BINS) bin = TTI_HISTOGRAM_BINS-1;
+            r.histogram[bin].fetch_add(1, memory_order_relaxed);
+            return usage;
+        }
+
+        /** @brief Number of registered stages **/
+        int numStages() const{
+            return numStages_.load();
+        }
+
+        /** @brief Deadline statistics of a stage **/
+        StageDeadlineStats stageStats(int stage) const{
+            const StageRecord & r = stages_[stage];
+            StageDeadlineStats st;
+            st.name = r.name;
+            st.budget = r.budget;
+            st.samples = r.samples.load();
+            st.misses = r.misses.load();
+            st.avgUsage = st.samples>0 ? double(r.usageSumPpm.load())/1e6/double(st.samples) : 0;
+            st.maxUsage = double(r.maxUsagePpm.load())/1e6;
+            for(int i=0;i<TTI_HISTOGRAM_BINS;i++) st.histogram[i] = r.histogram[i].load();
+            return st;
+        }
+};
+#endif  //INCLUDED_TTI_CLOCK_H
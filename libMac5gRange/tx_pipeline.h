@@ -0,0 +1,251 @@
+/* ***************************************/
+/* Copyright Notice                      */
+/* Copyright(c)2020 5G Range Consortium  */
+/* All rights Reserved                   */
+/*****************************************/
+
+#ifndef INCLUDED_TX_PIPELINE_H
+#define INCLUDED_TX_PIPELINE_H
+
+#include <cstdint>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <pthread.h>
+#include <sched.h>
+#include "libMac5gRange.h"
+#include "spsc_queue.h"
+
+/** Number of empty polls a stage spins before yielding the CPU **/
+#define PIPELINE_SPIN_LIMIT 64
+
+/**
+ * @brief Configuration of one TX pipeline stage (e.g. scheduling, PDU building, serialization, send)
+ */
+typedef struct{
+    string name;                        //Stage name, for statistics
+    int cpu = -1;                       //CPU the stage thread is pinned to (-1: not pinned)
+    function<bool(MacPDU &)> process;   //Stage body. First stage: fills a pooled PDU, false if there is nothing to send.
+                                        //Other stages: false drops the PDU (it still travels back to the pool).
+}PipelineStage;
+
+/**
+ * @brief Statistics of one pipeline stage
+ */
+typedef struct{
+    uint64_t processed;     //PDUs processed by the stage
+    uint64_t dropped;       //PDUs dropped by the stage
+    uint64_t stalls;        //Times the stage waited on a full output queue (backpressure)
+    double avgOccupancy;    //Average input queue occupancy seen when taking a PDU
+    size_t maxOccupancy;    //Largest input queue occupancy seen
+}PipelineStageStats;
+
+/**
+ * @brief Per-subframe TX pipeline with one pinned thread per stage.
+ *
+ * Stages are connected by bounded SPSC queues of pointers to a fixed pool of MacPDU objects. The last
+ * stage hands PDUs back to the first one through the free queue, so no PDU is allocated on the hot path.
+ * A full queue makes the upstream stage wait (backpressure) and an empty pool throttles the first stage.
+ * The pipeline follows the MacModes lifecycle: START_MODE runs it, IDLE_MODE (and STANDBY, CONFIG and
+ * RECONFIG modes) pause the first stage while the others drain, and STOP_MODE drains all stages and
+ * joins the threads.
+ */
+class TxPipeline{
+    private:
+        typedef struct{
+            MacPDU * pdu;
+            bool dropped;
+        }PipelineItem;
+
+        typedef struct{
+            alignas(CACHE_LINE_SIZE) atomic<uint64_t> processed {0};
+            atomic<uint64_t> dropped {0};
+            atomic<uint64_t> stalls {0};
+            atomic<uint64_t> taken {0};
+            atomic<uint64_t> occupancySum {0};
+            atomic<size_t> maxOccupancy {0};
+            atomic<bool> done {false};
+        }StageCounters;
+
+        vector<PipelineStage> stages_;
+        vector<unique_ptr<MacPDU>> pool_;
+        vector<unique_ptr<SpscQueue<PipelineItem>>> queues_;   //queues_[0]: free PDUs; queues_[s]: input of stage s
+        vector<unique_ptr<StageCounters>> counters_;
+        vector<thread> threads_;
+        atomic<int> mode_ {STANDBY_MODE};
+        MacPDU * held_ = nullptr;       //Free PDU the first stage held when it stopped (returned to the pool on join)
+
+        static void backoff(unsigned & spins){
+            if(++spins > PIPELINE_SPIN_LIMIT){
+                this_thread::yield();
+                spins = 0;
+            }
+        }
+
+        static void pinThread(int cpu){
+            if(cpu<0) return;
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(cpu, &cpuset);
+            if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset)!=0)
+                perror("Error pinning TX pipeline stage");
+        }
+
+        void stageLoop(size_t s){
+            pinThread(stages_[s].cpu);
+            const size_t numStages = stages_.size();
+            SpscQueue<PipelineItem> & input = *queues_[s];
+            SpscQueue<PipelineItem> & output = *queues_[(s+1)%numStages];
+            StageCounters & counters = *counters_[s];
+            PipelineItem item = {nullptr, false};
+            bool ready = false;         //item went through this stage and waits for the output queue
+            unsigned spins = 0;
+
+            while(true){
+                const int mode = mode_.load(memory_order_acquire);
+                if(item.pdu==nullptr){
+                    if(s==0 && mode==STOP_MODE) break;
+                    if(!input.tryPop(item)){
+                        if(mode==STOP_MODE && s>0 && counters_[s-1]->done.load(memory_order_acquire) && input.empty()) break;
+                        backoff(spins);
+                        continue;
+                    }
+                    ready = false;
+                    if(s>0){
+                        size_t occupancy = input.size()+1;
+                        counters.taken.fetch_add(1, memory_order_relaxed);
+                        counters.occupancySum.fetch_add(occupancy, memory_order_relaxed);
+                        if(occupancy > counters.maxOccupancy.load(memory_order_relaxed))
+                            counters.maxOccupancy.store(occupancy, memory_order_relaxed);
+                    }
+                }
+
+                if(!ready){
+                    if(s==0){
+                        //The first stage keeps its free PDU until it has something to send
+                        if(mode!=START_MODE){
+                            if(mode==STOP_MODE){
+                                held_ = item.pdu;
+                                break;
+                            }
+                            backoff(spins);
+                            continue;
+                        }
+                        if(!stages_[s].process(*item.pdu)){
+                            backoff(spins);
+                            continue;
+                        }
+                        counters.processed.fetch_add(1, memory_order_relaxed);
+                    }
+                    else if(!item.dropped){
+                        item.dropped = !stages_[s].process(*item.pdu);
+                        if(item.dropped) counters.dropped.fetch_add(1, memory_order_relaxed);
+                        else counters.processed.fetch_add(1, memory_order_relaxed);
+                    }
+                    if(s==numStages-1) item.dropped = false;    //Back to the pool
+                    ready = true;
+                }
+
+                if(output.tryPush(item)){
+                    item.pdu = nullptr;
+                    spins = 0;
+                }
+                else{
+                    counters.stalls.fetch_add(1, memory_order_relaxed);
+                    if(s==0 && mode==STOP_MODE){
+                        //Processed but never sent: dropped, and back to the pool on join
+                        counters.dropped.fetch_add(1, memory_order_relaxed);
+                        held_ = item.pdu;
+                        break;
+                    }
+                    backoff(spins);
+                }
+            }
+            counters.done.store(true, memory_order_release);
+        }
+
+    public:
+        /**
+         * @brief Construct a new TxPipeline object (threads start with START_MODE)
+         * @param stages: stage configurations, in processing order (at least one)
+         * @param poolSize: number of pooled MacPDU objects
+         * @param queueCapacity: capacity of each inter-stage queue
+         */
+        TxPipeline(const vector<PipelineStage> & stages, size_t poolSize, size_t queueCapacity){
+            assert(!stages.empty());    //The first stage owns the free queue (queues_[0])
+            stages_ = stages;
+            for(size_t s=0;s<stages_.size();s++){
+                size_t capacity = (s==0) ? poolSize : queueCapacity;   //The free queue holds the whole pool
+                queues_.emplace_back(new SpscQueue<PipelineItem>(capacity));
+                counters_.emplace_back(new StageCounters());
+            }
+            for(size_t i=0;i<poolSize;i++){
+                pool_.emplace_back(new MacPDU());
+                queues_[0]->tryPush({pool_.back().get(), false});
+            }
+        }
+
+        /** @brief Drains the pipeline and joins the stage threads **/
+        ~TxPipeline(){
+            setMode(STOP_MODE);
+        }
+
+        /**
+         * @brief Changes the pipeline mode (see: MacModes)
+         * START_MODE starts the threads on first use; STOP_MODE drains the stages and joins them.
+         */
+        void setMode(MacModes mode){
+            if(mode==STOP_MODE){
+                mode_.store(STOP_MODE, memory_order_release);
+                for(auto & t : threads_) t.join();
+                threads_.clear();
+                //No stage runs now, so the free queue can take the held PDU from this thread
+                if(held_!=nullptr){
+                    queues_[0]->tryPush({held_, false});
+                    held_ = nullptr;
+                }
+                return;
+            }
+            if(mode==START_MODE && threads_.empty()){
+                for(auto & c : counters_) c->done.store(false);
+                mode_.store(START_MODE, memory_order_release);
+                for(size_t s=0;s<stages_.size();s++)
+                    threads_.emplace_back(&TxPipeline::stageLoop, this, s);
+                return;
+            }
+            mode_.store(mode, memory_order_release);
+        }
+
+        /** @brief Current mode **/
+        MacModes mode() const{
+            return (MacModes) mode_.load(memory_order_acquire);
+        }
+
+        /** @brief Number of stages **/
+        size_t numStages() const{
+            return stages_.size();
+        }
+
+        /** @brief Number of PDUs currently waiting in the input queue of a stage (stage 0: free PDUs) **/
+        size_t occupancy(size_t stage) const{
+            return queues_[stage]->size();
+        }
+
+        /** @brief Statistics of a stage **/
+        PipelineStageStats stats(size_t stage) const{
+            const StageCounters & c = *counters_[stage];
+            PipelineStageStats st;
+            st.processed = c.processed.load();
+            st.dropped = c.dropped.load();
+            st.stalls = c.stalls.load();
+            uint64_t taken = c.taken.load();
+            st.avgOccupancy = (stage>0 && taken>0) ? double(c.occupancySum.load())/double(taken) : 0;
+            st.maxOccupancy = c.maxOccupancy.load();
+            return st;
+        }
+};
+#endif  //INCLUDED_TX_PIPELINE_H